@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Fixed-capacity, multi-producer/multi-consumer queue
+// Producers block while the queue is full, which is what provides backpressure between pipeline stages.
+// Once closed, pushes are rejected and consumers drain whatever is left before pop() starts returning false.
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity)
+		: m_capacity(capacity > 0 ? capacity : 1)
+	{
+	}
+
+	// blocks until there is room in the queue. returns false (and drops the item) if the queue was closed
+	bool push(T&& item)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+		if (m_closed)
+			return false;
+
+		m_items.push_back(std::move(item));
+		lock.unlock();
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// blocks until an item is available. returns false once the queue is closed and empty
+	bool pop(T& outItem)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+		if (m_items.empty())
+			return false;
+
+		outItem = std::move(m_items.front());
+		m_items.pop_front();
+		lock.unlock();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_closed = true;
+		}
+		m_notFull.notify_all();
+		m_notEmpty.notify_all();
+	}
+
+private:
+	std::mutex m_lock;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed = false;
+};
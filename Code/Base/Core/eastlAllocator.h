@@ -0,0 +1,4 @@
+#pragma once
+
+// number of allocations made through EASTL's allocator (i.e. every eastl container) since startup, across all threads
+unsigned long long getEastlAllocationCount();
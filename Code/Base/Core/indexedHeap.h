@@ -0,0 +1,119 @@
+#pragma once
+
+#include <EASTL/vector.h>
+
+// Binary max-heap of item indices, which tracks where each item sits in the heap
+// Items are identified by small integer indices (e.g. into some other array), and prioritized by a comparator over those
+// indices. Since each item's position is known, an item whose priority has changed can be sifted back into place with
+// update() in O(log n), rather than rebuilding the heap or searching the whole array for the new maximum.
+// compare(a, b) returns true if a has a lower priority than b, like std::less for a std::priority_queue.
+template<typename Compare>
+class IndexedHeap
+{
+public:
+	explicit IndexedHeap(Compare compare)
+		: m_compare(compare)
+	{
+	}
+
+	bool empty() const { return m_heap.empty(); }
+	size_t size() const { return m_heap.size(); }
+
+	// the item with the highest priority
+	unsigned int top() const { return m_heap.front(); }
+
+	bool contains(unsigned int item) const
+	{
+		return item < m_positions.size() && m_positions[item] != InvalidPosition;
+	}
+
+	// add an item that isn't in the heap yet
+	void push(unsigned int item)
+	{
+		if (item >= m_positions.size())
+			m_positions.resize(item + 1, InvalidPosition);
+
+		m_positions[item] = (unsigned int)m_heap.size();
+		m_heap.push_back(item);
+		siftUp(m_heap.size() - 1);
+	}
+
+	void pop()
+	{
+		m_positions[m_heap.front()] = InvalidPosition;
+		if (m_heap.size() > 1)
+		{
+			m_heap.front() = m_heap.back();
+			m_positions[m_heap.front()] = 0;
+			m_heap.pop_back();
+			siftDown(0);
+		}
+		else
+		{
+			m_heap.pop_back();
+		}
+	}
+
+	// restore the heap order after an item's priority has changed, in either direction
+	void update(unsigned int item)
+	{
+		size_t pos = m_positions[item];
+		siftUp(pos);
+		siftDown(m_positions[item]);
+	}
+
+	void clear()
+	{
+		m_heap.clear();
+		m_positions.clear();
+	}
+
+private:
+	static constexpr unsigned int InvalidPosition = ~0u;
+
+	void siftUp(size_t pos)
+	{
+		while (pos > 0)
+		{
+			size_t parentPos = (pos - 1) / 2;
+			if (!m_compare(m_heap[parentPos], m_heap[pos]))
+				break;
+
+			swapPositions(parentPos, pos);
+			pos = parentPos;
+		}
+	}
+
+	void siftDown(size_t pos)
+	{
+		while (true)
+		{
+			size_t largestPos = pos;
+			size_t leftPos = pos * 2 + 1;
+			size_t rightPos = leftPos + 1;
+			if (leftPos < m_heap.size() && m_compare(m_heap[largestPos], m_heap[leftPos]))
+				largestPos = leftPos;
+			if (rightPos < m_heap.size() && m_compare(m_heap[largestPos], m_heap[rightPos]))
+				largestPos = rightPos;
+			if (largestPos == pos)
+				break;
+
+			swapPositions(largestPos, pos);
+			pos = largestPos;
+		}
+	}
+
+	void swapPositions(size_t a, size_t b)
+	{
+		unsigned int itemA = m_heap[a];
+		m_heap[a] = m_heap[b];
+		m_heap[b] = itemA;
+		m_positions[m_heap[a]] = (unsigned int)a;
+		m_positions[m_heap[b]] = (unsigned int)b;
+	}
+
+	eastl::vector<unsigned int> m_heap;
+	// where each item is in m_heap, or InvalidPosition if it's not in the heap
+	eastl::vector<unsigned int> m_positions;
+	Compare m_compare;
+};
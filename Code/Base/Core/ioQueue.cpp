@@ -0,0 +1,391 @@
+#include "Pch.h"
+
+#include "ioQueue.h"
+
+#include <Core/trace.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef BP_HAS_IO_URING
+#include <liburing.h>
+#endif
+
+FILE* openForWrite(const std::filesystem::path& filePath)
+{
+#ifdef _WIN32
+	FILE* file;
+	return fopen_s(&file, filePath.generic_string().c_str(), "wb") ? nullptr : file;
+#else
+	return fopen(filePath.generic_string().c_str(), "wb");
+#endif
+}
+
+namespace
+{
+	bool syncFile(FILE* file)
+	{
+		if (fflush(file))
+			return false;
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	void reportWriteError(const std::filesystem::path& filePath)
+	{
+		// stdout may be carrying server responses, so errors go to stderr
+		std::cerr << "Failed to write file: " << filePath.generic_string() << "\n";
+	}
+}
+
+IoQueue::IoQueue(unsigned int numThreads, FsyncPolicy fsyncPolicy, unsigned long long maxBytesInFlight)
+	: m_fsyncPolicy(fsyncPolicy)
+	, m_maxBytesInFlight(maxBytesInFlight)
+{
+	numThreads = std::max(numThreads, 1u);
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		m_workers.emplace_back([this, i] { workerMain(i); });
+	}
+}
+
+IoQueue::~IoQueue()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_shutdown = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void IoQueue::submit(const std::filesystem::path& filePath, eastl::vector<unsigned char>&& data)
+{
+	unsigned long long size = data.size();
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+
+		// only hold up the caller if it's getting way ahead of the disk - a single oversized request is always let through
+		if (m_maxBytesInFlight > 0)
+		{
+			m_spaceAvailable.wait(lock, [this, size]
+				{ return m_bytesInFlight == 0 || m_bytesInFlight + size <= m_maxBytesInFlight; });
+		}
+
+		// coalesce with any queued write to the same file that hasn't been picked up yet
+		auto existingIter = std::find_if(m_requests.begin(), m_requests.end(),
+			[&filePath](const IoRequest& request) { return request.filePath == filePath; });
+		if (existingIter != m_requests.end())
+		{
+			m_bytesInFlight -= existingIter->data.size();
+			existingIter->data = std::move(data);
+		}
+		else
+		{
+			m_requests.push_back({ filePath, std::move(data) });
+			++m_queueDepth;
+		}
+		m_bytesInFlight += size;
+
+		m_stats.peakQueueDepth = std::max(m_stats.peakQueueDepth, (unsigned int)m_queueDepth);
+		m_stats.peakBytesInFlight = std::max(m_stats.peakBytesInFlight, (unsigned long long)m_bytesInFlight);
+	}
+	m_workAvailable.notify_one();
+}
+
+void IoQueue::flush()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_workFinished.wait(lock, [this] { return m_requests.empty() && m_activeBatches == 0; });
+}
+
+IoQueueStats IoQueue::getStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+void IoQueue::workerMain(unsigned int workerIdx)
+{
+	char threadName[32];
+	snprintf(threadName, 32, "io %u", workerIdx);
+	Tracer::setThreadName(threadName);
+
+#ifdef BP_HAS_IO_URING
+	// each I/O thread gets its own ring - room for a write and an fsync for every request in a full batch
+	io_uring ring;
+	bool hasRing = io_uring_queue_init(MaxBatchSize * 2, &ring, 0) == 0;
+#endif
+
+	IoBatch batch;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_workAvailable.wait(lock, [this] { return (m_shutdown && m_requests.empty()) || hasWritableRequest(); });
+			if (m_requests.empty())
+				break;
+
+			// take as much as is queued up, so it can be submitted together - apart from files another batch is still
+			// writing, which stay queued (in order) until that batch is done
+			for (auto requestIter = m_requests.begin(); requestIter != m_requests.end() && batch.size() < MaxBatchSize;)
+			{
+				if (isPathInFlight(requestIter->filePath))
+				{
+					++requestIter;
+					continue;
+				}
+
+				m_pathsInFlight.push_back(requestIter->filePath);
+				batch.push_back(std::move(*requestIter));
+				requestIter = m_requests.erase(requestIter);
+			}
+			++m_activeBatches;
+		}
+
+#ifdef BP_HAS_IO_URING
+		bool batchWritten = false;
+		if (hasRing)
+		{
+			batchWritten = writeBatchUring(ring, batch);
+
+			// if the ring fell over, stop using it - it could still have stale submissions in flight
+			if (!batchWritten)
+			{
+				io_uring_queue_exit(&ring);
+				hasRing = false;
+			}
+		}
+		if (!batchWritten)
+			writeBatchBlocking(batch);
+#else
+		writeBatchBlocking(batch);
+#endif
+		batch.clear();
+	}
+
+#ifdef BP_HAS_IO_URING
+	if (hasRing)
+		io_uring_queue_exit(&ring);
+#endif
+}
+
+void IoQueue::writeBatchBlocking(IoBatch& batch)
+{
+	TraceScope traceScope("writeBatchBlocking");
+	unsigned long long filesWritten = 0;
+	unsigned long long writeErrors = 0;
+
+	// with a per-batch policy, files are held open until the whole batch is written, then synced together
+	std::vector<std::pair<FILE*, const IoRequest*>> unsyncedFiles;
+	for (const auto& request : batch)
+	{
+		FILE* file = openForWrite(request.filePath);
+		if (!file)
+		{
+			reportWriteError(request.filePath);
+			++writeErrors;
+			continue;
+		}
+
+		bool succeeded = fwrite(request.data.data(), 1, request.data.size(), file) == request.data.size();
+		if (succeeded && m_fsyncPolicy == FsyncPolicy::PerBatch)
+		{
+			unsyncedFiles.push_back(std::make_pair(file, &request));
+			continue;
+		}
+
+		if (succeeded && m_fsyncPolicy == FsyncPolicy::PerFile)
+			succeeded = syncFile(file);
+		succeeded = (fclose(file) == 0) && succeeded;
+
+		if (succeeded)
+			++filesWritten;
+		else
+		{
+			reportWriteError(request.filePath);
+			++writeErrors;
+		}
+	}
+
+	for (auto& unsyncedFile : unsyncedFiles)
+	{
+		bool succeeded = syncFile(unsyncedFile.first);
+		succeeded = (fclose(unsyncedFile.first) == 0) && succeeded;
+		if (succeeded)
+			++filesWritten;
+		else
+		{
+			reportWriteError(unsyncedFile.second->filePath);
+			++writeErrors;
+		}
+	}
+
+	// close the span before the batch is marked as finished, so it's recorded by the time a flush() returns
+	traceScope.end();
+	finishBatch(batch, filesWritten, writeErrors);
+}
+
+#ifdef BP_HAS_IO_URING
+bool IoQueue::writeBatchUring(io_uring& ring, IoBatch& batch)
+{
+	TraceScope traceScope("writeBatchUring");
+	unsigned long long filesWritten = 0;
+	unsigned long long writeErrors = 0;
+
+	std::vector<int> fds(batch.size(), -1);
+	std::vector<bool> failed(batch.size(), false);
+	unsigned int pendingCompletions = 0;
+
+	// completions are tagged with the request index, and whether they came from a write or an fsync
+	auto makeUserData = [](unsigned int requestIdx, bool isFsync) { return (void*)(uintptr_t)((requestIdx << 1) | (isFsync ? 1 : 0)); };
+
+	// queue up a write (plus a linked fsync, if every file needs one) for every request, then submit them all at once
+	for (unsigned int i = 0; i < batch.size(); ++i)
+	{
+		fds[i] = open(batch[i].filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fds[i] < 0)
+		{
+			failed[i] = true;
+			continue;
+		}
+
+		io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+		io_uring_prep_write(sqe, fds[i], batch[i].data.data(), (unsigned int)batch[i].data.size(), 0);
+		io_uring_sqe_set_data(sqe, makeUserData(i, false));
+		++pendingCompletions;
+
+		if (m_fsyncPolicy == FsyncPolicy::PerFile)
+		{
+			sqe->flags |= IOSQE_IO_LINK;
+			sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_fsync(sqe, fds[i], 0);
+			io_uring_sqe_set_data(sqe, makeUserData(i, true));
+			++pendingCompletions;
+		}
+	}
+
+	auto reapCompletions = [&ring, &pendingCompletions, &failed, &batch]
+	{
+		if (io_uring_submit(&ring) < 0)
+			return false;
+
+		while (pendingCompletions > 0)
+		{
+			io_uring_cqe* cqe;
+			if (io_uring_wait_cqe(&ring, &cqe) < 0)
+				return false;
+
+			uintptr_t userData = (uintptr_t)io_uring_cqe_get_data(cqe);
+			unsigned int requestIdx = (unsigned int)(userData >> 1);
+			bool isFsync = (userData & 1) != 0;
+
+			// writes to regular files should never come up short, but treat it as a failure if one does
+			if (cqe->res < 0 || (!isFsync && (size_t)cqe->res != batch[requestIdx].data.size()))
+				failed[requestIdx] = true;
+			io_uring_cqe_seen(&ring, cqe);
+			--pendingCompletions;
+		}
+		return true;
+	};
+
+	bool ringSucceeded = reapCompletions();
+
+	if (ringSucceeded && m_fsyncPolicy == FsyncPolicy::PerBatch)
+	{
+		for (unsigned int i = 0; i < batch.size(); ++i)
+		{
+			if (failed[i])
+				continue;
+
+			io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+			io_uring_prep_fsync(sqe, fds[i], 0);
+			io_uring_sqe_set_data(sqe, makeUserData(i, true));
+			++pendingCompletions;
+		}
+		ringSucceeded = reapCompletions();
+	}
+
+	for (unsigned int i = 0; i < batch.size(); ++i)
+	{
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
+	// if the ring itself fell over, let the caller redo the whole batch with blocking writes
+	if (!ringSucceeded)
+		return false;
+
+	for (unsigned int i = 0; i < batch.size(); ++i)
+	{
+		if (failed[i])
+		{
+			reportWriteError(batch[i].filePath);
+			++writeErrors;
+		}
+		else
+			++filesWritten;
+	}
+
+	// close the span before the batch is marked as finished, so it's recorded by the time a flush() returns
+	traceScope.end();
+	finishBatch(batch, filesWritten, writeErrors);
+	return true;
+}
+#endif
+
+void IoQueue::finishBatch(const IoBatch& batch, unsigned long long filesWritten, unsigned long long writeErrors)
+{
+	unsigned long long batchBytes = 0;
+	for (const auto& request : batch)
+	{
+		batchBytes += request.data.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_queueDepth -= (unsigned int)batch.size();
+		m_bytesInFlight -= batchBytes;
+		m_stats.filesWritten += filesWritten;
+		m_stats.bytesWritten += batchBytes;
+		m_stats.batchesSubmitted += 1;
+		m_stats.writeErrors += writeErrors;
+		--m_activeBatches;
+
+		for (const auto& request : batch)
+		{
+			m_pathsInFlight.erase(std::find(m_pathsInFlight.begin(), m_pathsInFlight.end(), request.filePath));
+		}
+	}
+	m_spaceAvailable.notify_all();
+	m_workFinished.notify_all();
+
+	// any requests held back for the files in this batch can be written now
+	m_workAvailable.notify_all();
+}
+
+bool IoQueue::isPathInFlight(const std::filesystem::path& filePath) const
+{
+	return std::find(m_pathsInFlight.begin(), m_pathsInFlight.end(), filePath) != m_pathsInFlight.end();
+}
+
+bool IoQueue::hasWritableRequest() const
+{
+	return std::any_of(m_requests.begin(), m_requests.end(),
+		[this](const IoRequest& request) { return !isPathInFlight(request.filePath); });
+}
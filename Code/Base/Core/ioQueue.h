@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <EASTL/vector.h>
+
+#ifdef BP_HAS_IO_URING
+struct io_uring;
+#endif
+
+// open a file for writing in binary, truncating it if it exists. returns nullptr if it couldn't be opened
+FILE* openForWrite(const std::filesystem::path& filePath);
+
+// when finished writes are made durable
+enum class FsyncPolicy
+{
+	None, // leave it to the OS
+	PerFile, // fsync every file as it's written
+	PerBatch // fsync every file in a batch once the whole batch has been written
+};
+
+struct IoQueueStats
+{
+	unsigned long long filesWritten;
+	unsigned long long bytesWritten;
+	unsigned long long batchesSubmitted;
+	unsigned long long writeErrors;
+	unsigned int peakQueueDepth;
+	unsigned long long peakBytesInFlight;
+};
+
+// Write-behind I/O queue
+// Takes ownership of finished buffers and writes them out on dedicated I/O threads, so the threads producing the
+// data never wait on the disk. Each I/O thread drains everything queued up (to a limit) into a batch, and submits
+// the whole batch at once - through io_uring when it's available (BP_HAS_IO_URING), or plain blocking writes otherwise.
+class IoQueue
+{
+public:
+	// maxBytesInFlight caps how much data may be queued up before submit() starts blocking; 0 means no cap
+	IoQueue(unsigned int numThreads, FsyncPolicy fsyncPolicy, unsigned long long maxBytesInFlight);
+	~IoQueue();
+
+	// queue data to be written to filePath, replacing any existing file
+	// if the same path is queued more than once before being written, only the latest data is written. writes to the
+	// same path are never made at once, and always land in the order they were submitted
+	void submit(const std::filesystem::path& filePath, eastl::vector<unsigned char>&& data);
+
+	// block until everything submitted so far has been written
+	void flush();
+
+	unsigned int getQueueDepth() const { return m_queueDepth; }
+	unsigned long long getBytesInFlight() const { return m_bytesInFlight; }
+	IoQueueStats getStats() const;
+
+private:
+	struct IoRequest
+	{
+		std::filesystem::path filePath;
+		eastl::vector<unsigned char> data;
+	};
+	typedef std::vector<IoRequest> IoBatch;
+
+	static const unsigned int MaxBatchSize = 64;
+
+	void workerMain(unsigned int workerIdx);
+	void writeBatchBlocking(IoBatch& batch);
+#ifdef BP_HAS_IO_URING
+	bool writeBatchUring(struct io_uring& ring, IoBatch& batch);
+#endif
+	void finishBatch(const IoBatch& batch, unsigned long long filesWritten, unsigned long long writeErrors);
+	// whether a batch that's being written has a request for filePath. m_lock must be held
+	bool isPathInFlight(const std::filesystem::path& filePath) const;
+	bool hasWritableRequest() const;
+
+	FsyncPolicy m_fsyncPolicy;
+	unsigned long long m_maxBytesInFlight;
+
+	mutable std::mutex m_lock;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_spaceAvailable;
+	std::condition_variable m_workFinished;
+	std::deque<IoRequest> m_requests;
+	// paths of every request in the batches being written. a queued request for one of these is held back until its
+	// batch finishes, so two threads never write the same file at once
+	std::vector<std::filesystem::path> m_pathsInFlight;
+	unsigned int m_activeBatches = 0;
+	bool m_shutdown = false;
+	std::vector<std::thread> m_workers;
+
+	// counters - requests/bytes that have been submitted but not yet written
+	std::atomic<unsigned int> m_queueDepth{ 0 };
+	std::atomic<unsigned long long> m_bytesInFlight{ 0 };
+	IoQueueStats m_stats = {};
+};
@@ -1,15 +1,29 @@
 #include "Pch.h"
 
+#include "eastlAllocator.h"
+
 #include <EASTL/allocator.h>
 
+#include <atomic>
+
+namespace
+{
+	std::atomic<unsigned long long> s_eastlAllocationCount{ 0 };
+}
+
 void* operator new[](size_t size, const char* pName, int flags, unsigned debugFlags, const char* file, int line)
 {
+	s_eastlAllocationCount.fetch_add(1, std::memory_order_relaxed);
 	return malloc(size);
 }
 
 void* operator new[](size_t size, size_t alignment, size_t alignmentOffset, const char* pName, int flags, unsigned debugFlags, const char* file, int line)
 {
+	s_eastlAllocationCount.fetch_add(1, std::memory_order_relaxed);
 	return malloc(size);
 }
 
-
+unsigned long long getEastlAllocationCount()
+{
+	return s_eastlAllocationCount.load(std::memory_order_relaxed);
+}
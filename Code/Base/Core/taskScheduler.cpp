@@ -0,0 +1,221 @@
+#include "Pch.h"
+
+#include "taskScheduler.h"
+
+#include <Core/trace.h>
+
+#include <algorithm>
+
+namespace
+{
+	const unsigned int InvalidQueueIdx = ~0u;
+
+	// queue owned by the current thread, if it is one of the scheduler's workers
+	thread_local unsigned int t_workerQueueIdx = InvalidQueueIdx;
+
+	std::once_flag s_schedulerInitFlag;
+	std::unique_ptr<TaskScheduler> s_scheduler;
+}
+
+void TaskScheduler::init(unsigned int numThreads)
+{
+	std::call_once(s_schedulerInitFlag, [numThreads]
+	{
+		unsigned int threadCount = numThreads;
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		s_scheduler.reset(new TaskScheduler(threadCount));
+	});
+}
+
+TaskScheduler& TaskScheduler::get()
+{
+	init(0);
+	return *s_scheduler;
+}
+
+TaskScheduler::TaskScheduler(unsigned int numThreads)
+{
+	// the thread that creates the scheduler (and any other outside thread) counts as a worker while it waits on tasks
+	unsigned int numWorkers = numThreads - 1;
+	for (unsigned int i = 0; i < numWorkers + 1; ++i)
+	{
+		m_queues.emplace_back(new TaskQueue);
+	}
+
+	m_workers.reserve(numWorkers);
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		m_workers.emplace_back([this, i] { workerMain(i); });
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_shutdown = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void TaskScheduler::submit(Task&& task)
+{
+	TaskQueue& queue = *m_queues[getLocalQueueIdx()];
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	++m_queuedTasks;
+
+	// take the sleep lock so a worker can't miss this wakeup between checking for tasks and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+	}
+	m_wakeCondition.notify_one();
+}
+
+bool TaskScheduler::tryRunTask()
+{
+	unsigned int queueIdx = getLocalQueueIdx();
+
+	Task task;
+	if (!popTask(queueIdx, task) && !stealTask(queueIdx, task))
+		return false;
+
+	// an exception is handed to the group rather than let out, so the task still counts as done and the group's
+	// waiter doesn't spin forever
+	std::exception_ptr exception;
+	try
+	{
+		task.func();
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+	task.group->completeTask(exception);
+	return true;
+}
+
+void TaskScheduler::wakeAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+	}
+	m_wakeCondition.notify_all();
+}
+
+void TaskScheduler::waitForTasks(const TaskGroup& group)
+{
+	std::unique_lock<std::mutex> lock(m_sleepLock);
+	m_wakeCondition.wait(lock, [this, &group] { return m_shutdown || m_queuedTasks > 0 || group.m_pendingTasks == 0; });
+}
+
+void TaskScheduler::workerMain(unsigned int queueIdx)
+{
+	t_workerQueueIdx = queueIdx;
+
+	char threadName[32];
+	snprintf(threadName, 32, "worker %u", queueIdx);
+	Tracer::setThreadName(threadName);
+
+	while (true)
+	{
+		if (tryRunTask())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wakeCondition.wait(lock, [this] { return m_shutdown || m_queuedTasks > 0; });
+		if (m_shutdown)
+			break;
+	}
+}
+
+bool TaskScheduler::popTask(unsigned int queueIdx, Task& outTask)
+{
+	TaskQueue& queue = *m_queues[queueIdx];
+	std::lock_guard<std::mutex> lock(queue.lock);
+	if (queue.tasks.empty())
+		return false;
+
+	// newest task first, from the owner's end of the deque
+	outTask = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	--m_queuedTasks;
+	return true;
+}
+
+bool TaskScheduler::stealTask(unsigned int queueIdx, Task& outTask)
+{
+	if (m_queuedTasks == 0)
+		return false;
+
+	// oldest task first, from the far end of a victim's deque - it's likely the largest remaining piece of work
+	unsigned int numQueues = (unsigned int)m_queues.size();
+	for (unsigned int i = 1; i < numQueues; ++i)
+	{
+		TaskQueue& victim = *m_queues[(queueIdx + i) % numQueues];
+		std::lock_guard<std::mutex> lock(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			outTask = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			--m_queuedTasks;
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned int TaskScheduler::getLocalQueueIdx() const
+{
+	// threads outside of the pool all share the last queue
+	return t_workerQueueIdx != InvalidQueueIdx ? t_workerQueueIdx : (unsigned int)m_workers.size();
+}
+
+void TaskGroup::wait()
+{
+	waitForCompletion();
+
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(m_exceptionLock);
+		exception = std::move(m_exception);
+		m_exception = nullptr;
+	}
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void TaskGroup::waitForCompletion()
+{
+	TaskScheduler& scheduler = TaskScheduler::get();
+	while (m_pendingTasks > 0)
+	{
+		// the remaining tasks are running on other threads - sleep until they're done or there's something to help with
+		if (!scheduler.tryRunTask())
+			scheduler.waitForTasks(*this);
+	}
+}
+
+void TaskGroup::completeTask(std::exception_ptr exception)
+{
+	if (exception)
+	{
+		std::lock_guard<std::mutex> lock(m_exceptionLock);
+		if (!m_exception)
+			m_exception = exception;
+	}
+
+	if (--m_pendingTasks == 0)
+	{
+		// anything sleeping in waitForTasks needs to recheck, as this group might be the one it's waiting on
+		TaskScheduler::get().wakeAll();
+	}
+}
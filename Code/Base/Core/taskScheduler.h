@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class TaskGroup;
+
+struct Task
+{
+	std::function<void()> func;
+	TaskGroup* group = nullptr;
+};
+
+// Work-stealing task scheduler
+// Every worker thread owns a deque: it pushes and pops its own tasks at the back (so nested tasks stay hot in cache)
+// and steals from the front of other deques when it runs dry. Threads outside of the pool submit into a shared deque.
+// Threads waiting on a TaskGroup execute pending tasks instead of blocking, so tasks that spawn and wait on subtasks
+// never put more threads to work than the pool was created with.
+class TaskScheduler
+{
+public:
+	// create the pool - numThreads counts the calling thread, and 0 means "use every hardware thread"
+	// has no effect if the scheduler has already been created
+	static void init(unsigned int numThreads);
+	static TaskScheduler& get();
+
+	~TaskScheduler();
+
+	unsigned int getNumThreads() const { return (unsigned int)m_workers.size() + 1; }
+
+	void submit(Task&& task);
+
+	// run a single pending task on the calling thread, if one can be found. returns false if no task was run
+	bool tryRunTask();
+
+private:
+	friend class TaskGroup;
+
+	struct TaskQueue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	explicit TaskScheduler(unsigned int numThreads);
+
+	void workerMain(unsigned int queueIdx);
+	bool popTask(unsigned int queueIdx, Task& outTask);
+	bool stealTask(unsigned int queueIdx, Task& outTask);
+	unsigned int getLocalQueueIdx() const;
+	// block until there's a task that could be run, or the group has no tasks left
+	void waitForTasks(const TaskGroup& group);
+	void wakeAll();
+
+	// one queue per worker, plus one trailing queue shared by all threads outside of the pool
+	std::vector<std::unique_ptr<TaskQueue>> m_queues;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_wakeCondition;
+	std::atomic<int> m_queuedTasks{ 0 };
+	std::atomic<bool> m_shutdown{ false };
+};
+
+// Tracks a set of tasks submitted to the scheduler so they can be waited on together
+class TaskGroup
+{
+public:
+	TaskGroup() = default;
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+	~TaskGroup() { waitForCompletion(); }
+
+	template<typename Func>
+	void run(Func&& func)
+	{
+		++m_pendingTasks;
+		TaskScheduler::get().submit({ std::forward<Func>(func), this });
+	}
+
+	// helps execute tasks (this group's or any other's) until every task in this group has completed
+	// if any of this group's tasks threw, the first exception is rethrown here once all of them are done
+	void wait();
+
+private:
+	friend class TaskScheduler;
+
+	void waitForCompletion();
+	void completeTask(std::exception_ptr exception);
+
+	std::atomic<int> m_pendingTasks{ 0 };
+	std::mutex m_exceptionLock;
+	std::exception_ptr m_exception;
+};
+
+// run all of the provided callables, potentially in parallel, and return once they have all completed
+// the first callable is run directly on the calling thread
+template<typename Func, typename... Funcs>
+void parallelInvoke(Func&& func, Funcs&&... funcs)
+{
+	TaskGroup tasks;
+	(tasks.run(std::forward<Funcs>(funcs)), ...);
+	func();
+	tasks.wait();
+}
@@ -0,0 +1,195 @@
+#include "Pch.h"
+
+#include "trace.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	struct TraceSpan
+	{
+		const char* name;
+		eastl::string detail;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+	};
+
+	struct ThreadTraceBuffer
+	{
+		// only contended while exporting
+		std::mutex lock;
+		unsigned int threadIdx = 0;
+		eastl::string threadName;
+		std::vector<TraceSpan> spans;
+	};
+
+	std::atomic<bool> s_traceEnabled{ false };
+	std::chrono::steady_clock::time_point s_traceEpoch;
+
+	// buffers are owned here rather than by their threads, so spans outlive the threads that recorded them
+	std::mutex s_bufferListLock;
+	std::vector<std::unique_ptr<ThreadTraceBuffer>> s_buffers;
+
+	thread_local ThreadTraceBuffer* t_buffer = nullptr;
+
+	ThreadTraceBuffer& getThreadBuffer()
+	{
+		if (!t_buffer)
+		{
+			std::lock_guard<std::mutex> lock(s_bufferListLock);
+			s_buffers.emplace_back(new ThreadTraceBuffer);
+			t_buffer = s_buffers.back().get();
+			t_buffer->threadIdx = (unsigned int)s_buffers.size();
+		}
+		return *t_buffer;
+	}
+
+	void writeJsonString(std::ostream& out, const char* str)
+	{
+		out << '"';
+		for (; *str; ++str)
+		{
+			char c = *str;
+			if (c == '"' || c == '\\')
+				out << '\\' << c;
+			else if ((unsigned char)c < 0x20)
+			{
+				char escaped[8];
+				snprintf(escaped, 8, "\\u%04x", c);
+				out << escaped;
+			}
+			else
+				out << c;
+		}
+		out << '"';
+	}
+
+	// trace-event timestamps are in (fractional) microseconds
+	double getTraceTimestamp(std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration<double, std::micro>(time - s_traceEpoch).count();
+	}
+}
+
+void Tracer::enable()
+{
+	std::lock_guard<std::mutex> lock(s_bufferListLock);
+	if (!s_traceEnabled)
+	{
+		s_traceEpoch = std::chrono::steady_clock::now();
+		s_traceEnabled = true;
+	}
+}
+
+bool Tracer::isEnabled()
+{
+	return s_traceEnabled.load(std::memory_order_relaxed);
+}
+
+void Tracer::setThreadName(const char* name)
+{
+	ThreadTraceBuffer& buffer = getThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.lock);
+	buffer.threadName = name;
+}
+
+void Tracer::recordSpan(const char* name, eastl::string&& detail, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	ThreadTraceBuffer& buffer = getThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.lock);
+	buffer.spans.push_back({ name, eastl::move(detail), start, end });
+}
+
+void Tracer::writeChromeJson(std::ostream& out)
+{
+	std::lock_guard<std::mutex> listLock(s_bufferListLock);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool firstEvent = true;
+	auto beginEvent = [&out, &firstEvent]
+	{
+		out << (firstEvent ? "\n" : ",\n");
+		firstEvent = false;
+	};
+
+	for (const auto& buffer : s_buffers)
+	{
+		std::lock_guard<std::mutex> lock(buffer->lock);
+
+		// metadata event, so the thread shows up under its name rather than just its id
+		eastl::string threadName = buffer->threadName;
+		if (threadName.empty())
+			threadName.sprintf("thread %u", buffer->threadIdx);
+		beginEvent();
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIdx << ",\"args\":{\"name\":";
+		writeJsonString(out, threadName.c_str());
+		out << "}}";
+
+		for (const auto& span : buffer->spans)
+		{
+			char timing[64];
+			snprintf(timing, 64, "\"ts\":%.3f,\"dur\":%.3f", getTraceTimestamp(span.start), getTraceTimestamp(span.end) - getTraceTimestamp(span.start));
+
+			// complete events carry their own duration, so nesting is reconstructed from the timestamps
+			beginEvent();
+			out << "{\"name\":";
+			writeJsonString(out, span.name);
+			out << ",\"cat\":\"bp\",\"ph\":\"X\"," << timing << ",\"pid\":1,\"tid\":" << buffer->threadIdx;
+			if (!span.detail.empty())
+			{
+				out << ",\"args\":{\"file\":";
+				writeJsonString(out, span.detail.c_str());
+				out << "}";
+			}
+			out << "}";
+		}
+	}
+	out << "\n]}\n";
+}
+
+TraceScope::TraceScope(const char* name)
+{
+	if (Tracer::isEnabled())
+	{
+		m_name = name;
+		m_start = std::chrono::steady_clock::now();
+	}
+}
+
+TraceScope::TraceScope(const char* name, const char* detail)
+{
+	if (Tracer::isEnabled())
+	{
+		m_name = name;
+		m_detail = detail;
+		m_start = std::chrono::steady_clock::now();
+	}
+}
+
+TraceScope::TraceScope(const char* name, const std::filesystem::path& file)
+{
+	if (Tracer::isEnabled())
+	{
+		m_name = name;
+		m_detail = file.filename().generic_string().c_str();
+		m_start = std::chrono::steady_clock::now();
+	}
+}
+
+TraceScope::~TraceScope()
+{
+	end();
+}
+
+void TraceScope::end()
+{
+	// only spans that were opened while tracing was enabled get recorded, and only once
+	if (m_name)
+	{
+		Tracer::recordSpan(m_name, eastl::move(m_detail), m_start, std::chrono::steady_clock::now());
+		m_name = nullptr;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <ostream>
+
+#include <EASTL/string.h>
+
+// Scoped span tracer
+// Spans are recorded into a buffer per thread (so recording never contends with other threads), tagged with the
+// thread and, optionally, the file being worked on. Recording is off until Tracer::enable() is called - a disabled
+// TraceScope costs a single flag check. Everything recorded can be exported as Chrome trace-event JSON, which both
+// chrome://tracing and Perfetto can load.
+class Tracer
+{
+public:
+	static void enable();
+	static bool isEnabled();
+
+	// name the calling thread in exported traces; threads that are never named are exported by their index
+	static void setThreadName(const char* name);
+
+	// write out every span recorded so far, on every thread. spans that are still open are left out
+	static void writeChromeJson(std::ostream& out);
+
+private:
+	friend class TraceScope;
+	static void recordSpan(const char* name, eastl::string&& detail, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+};
+
+// record a span from construction until destruction
+// name must be a string literal (or otherwise outlive the trace); detail is copied, and exported as the span's file
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name);
+	TraceScope(const char* name, const char* detail);
+	TraceScope(const char* name, const std::filesystem::path& file);
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+	~TraceScope();
+
+	// close the span before the scope ends
+	void end();
+
+private:
+	const char* m_name = nullptr;
+	eastl::string m_detail;
+	std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,15 @@
+#include "Pch.h"
+
+#include "backgroundProcessor.h"
+
+bool processPixels(const unsigned char* rgbPixels, unsigned int width, unsigned int height, const ProcessImageParams& params,
+	ProcessImageStorage& storage, ImageArtifactList& outArtifacts)
+{
+	storage.srcImg = createImageFromPixels(rgbPixels, width, height);
+	if (!isProcessableImage(storage.srcImg))
+		return false;
+
+	processImage(params, storage);
+	outArtifacts = encodeImageArtifacts(params, storage);
+	return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Public interface for libbackgroundprocessor
+// Everything here works on caller-supplied buffers - nothing is read from or written to disk. Work is spread over the
+// shared task scheduler, which starts up on first use with a thread per core unless TaskScheduler::init is called first.
+
+#include <Core/taskScheduler.h>
+#include <Main/imageArtifacts.h>
+#include <Main/imageCommon.h>
+#include <Main/imageEncode.h>
+#include <Main/imageNtscFilter.h>
+#include <Main/imageProcess.h>
+
+// quantize already-decoded 8-bit rgb pixels according to params, and encode every output in memory
+// outputs are named after params.inFilePath's stem (and pathed into params.outDirPath), though neither has to exist
+// storage may be reused between calls to avoid reallocating. returns false if the image is larger than 256x224
+bool processPixels(const unsigned char* rgbPixels, unsigned int width, unsigned int height, const ProcessImageParams& params,
+	ProcessImageStorage& storage, ImageArtifactList& outArtifacts);
@@ -0,0 +1,279 @@
+#include "Pch.h"
+
+#include "batchPipeline.h"
+
+#include <Core/boundedQueue.h>
+#include <Core/taskScheduler.h>
+#include <Core/trace.h>
+#include <Main/imageArtifacts.h>
+#include <Main/imageCache.h>
+#include <Main/imageio.h>
+#include <Main/imageProcess.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	struct BatchJob
+	{
+		ProcessImageParams params;
+		ProcessImageStorage storage;
+		ImageArtifactList artifacts;
+		uint64_t cacheKey = 0;
+	};
+
+	typedef std::unique_ptr<BatchJob> BatchJobPtr;
+
+	// spin up the threads for one stage of the pipeline (named after the stage in traces); each thread pulls from the input queue,
+	// runs stageFunc, and forwards the item to the output queue if stageFunc returned true
+	// the last thread of the stage to finish closes the output queue, so the next stage can drain and exit
+	template<typename InType, typename OutType, typename StageFunc>
+	void startStage(std::vector<std::thread>& threads, const char* stageName, unsigned int numThreads,
+		BoundedQueue<InType>& inQueue, BoundedQueue<OutType>* outQueue, StageFunc stageFunc)
+	{
+		numThreads = numThreads > 0 ? numThreads : 1;
+		auto activeThreads = std::make_shared<std::atomic<unsigned int>>(numThreads);
+		for (unsigned int i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back([&inQueue, outQueue, stageFunc, activeThreads, stageName, i]
+			{
+				eastl::string threadName;
+				threadName.sprintf("%s stage %u", stageName, i);
+				Tracer::setThreadName(threadName.c_str());
+
+				InType item;
+				while (inQueue.pop(item))
+				{
+					OutType outItem;
+					if (stageFunc(item, outItem) && outQueue)
+						outQueue->push(std::move(outItem));
+				}
+
+				if (--(*activeThreads) == 0 && outQueue)
+					outQueue->close();
+			});
+		}
+	}
+
+	// like startStage, but the work is run as tasks on the scheduler rather than on threads of the stage's own, so it
+	// shares the pool with the tasks it fans out into instead of competing with it. a single thread feeds the stage,
+	// keeping up to maxInFlight items in flight, and helps run tasks while it waits for room (which is what keeps things
+	// moving when the pool has no workers of its own)
+	// any thread waiting on a TaskGroup can end up running one of these tasks, including the next stage's, so a task
+	// must never block on the output queue. finished items are handed back to the feeding thread to push instead, and
+	// stay counted as in flight until they've been pushed
+	template<typename StageFunc>
+	void startSchedulerStage(std::vector<std::thread>& threads, const char* stageName, unsigned int maxInFlight,
+		BoundedQueue<BatchJobPtr>& inQueue, BoundedQueue<BatchJobPtr>& outQueue, StageFunc stageFunc)
+	{
+		maxInFlight = maxInFlight > 0 ? maxInFlight : 1;
+		threads.emplace_back([&inQueue, &outQueue, stageFunc, stageName, maxInFlight]
+		{
+			// the next stage only exits once the queue is closed, so it's closed however this thread exits
+			struct OutQueueCloser
+			{
+				BoundedQueue<BatchJobPtr>& queue;
+				~OutQueueCloser() { queue.close(); }
+			} outQueueCloser{ outQueue };
+
+			eastl::string threadName;
+			threadName.sprintf("%s stage", stageName);
+			Tracer::setThreadName(threadName.c_str());
+
+			struct InFlightState
+			{
+				std::mutex lock;
+				std::condition_variable changed;
+				unsigned int count = 0;
+				std::vector<BatchJobPtr> finishedItems;
+			} inFlight;
+
+			// the list handed back to the tasks always has room for every item in flight, so they never have to grow it
+			inFlight.finishedItems.reserve(maxInFlight);
+			auto pushFinishedItems = [&outQueue, &inFlight, maxInFlight]
+			{
+				std::vector<BatchJobPtr> finishedItems;
+				finishedItems.reserve(maxInFlight);
+				{
+					std::lock_guard<std::mutex> lock(inFlight.lock);
+					finishedItems.swap(inFlight.finishedItems);
+				}
+				for (BatchJobPtr& finishedItem : finishedItems)
+				{
+					outQueue.push(std::move(finishedItem));
+				}
+
+				std::lock_guard<std::mutex> lock(inFlight.lock);
+				inFlight.count -= (unsigned int)finishedItems.size();
+			};
+
+			// help out with tasks (or sleep, if there are none) until canContinue, pushing items as they finish
+			TaskScheduler& scheduler = TaskScheduler::get();
+			auto waitUntil = [&scheduler, &inFlight, &pushFinishedItems](auto canContinue)
+			{
+				while (true)
+				{
+					pushFinishedItems();
+					{
+						std::lock_guard<std::mutex> lock(inFlight.lock);
+						if (canContinue())
+							return;
+					}
+
+					if (!scheduler.tryRunTask())
+					{
+						std::unique_lock<std::mutex> lock(inFlight.lock);
+						inFlight.changed.wait(lock, [&inFlight, &canContinue] { return canContinue() || !inFlight.finishedItems.empty(); });
+					}
+				}
+			};
+
+			TaskGroup tasks;
+			BatchJobPtr item;
+			while (inQueue.pop(item))
+			{
+				waitUntil([&inFlight, maxInFlight] { return inFlight.count < maxInFlight; });
+				{
+					std::lock_guard<std::mutex> lock(inFlight.lock);
+					++inFlight.count;
+				}
+
+				// tasks have to be copyable, so the job rides along as a raw pointer
+				BatchJob* job = item.release();
+				tasks.run([&inFlight, stageFunc, job]
+				{
+					// the item is handed back (or its slot given up, if there's nothing to pass on) however the task
+					// ends, or the feeding thread would wait on it forever
+					struct FinishedItem
+					{
+						InFlightState& inFlight;
+						BatchJobPtr item;
+						~FinishedItem()
+						{
+							{
+								std::lock_guard<std::mutex> lock(inFlight.lock);
+								if (item)
+									inFlight.finishedItems.push_back(std::move(item));
+								else
+									--inFlight.count;
+							}
+							inFlight.changed.notify_one();
+						}
+					} finishedItem{ inFlight, nullptr };
+
+					// one image failing (i.e. running out of memory) shouldn't take the rest of the batch down with it,
+					// so it's reported and dropped
+					BatchJobPtr taskItem(job);
+					const std::filesystem::path inFilePath = taskItem->params.inFilePath;
+					try
+					{
+						BatchJobPtr outItem;
+						if (stageFunc(taskItem, outItem))
+							finishedItem.item = std::move(outItem);
+					}
+					catch (const std::exception& e)
+					{
+						std::cout << "Could not process " << inFilePath.c_str() << ": " << e.what() << "\n";
+					}
+					catch (...)
+					{
+						std::cout << "Could not process " << inFilePath.c_str() << "\n";
+					}
+				});
+			}
+
+			waitUntil([&inFlight] { return inFlight.count == 0; });
+			tasks.wait();
+		});
+	}
+}
+
+void processDirectory(const ProcessImageParams& params, const std::filesystem::path& inDirPath, const BatchPipelineLimits& limits,
+	ImageCache* cache, PackWriter* batchPack, IoQueue& ioQueue)
+{
+	const unsigned int queueDepth = limits.queueDepth;
+	BoundedQueue<std::filesystem::path> fileQueue(queueDepth);
+	BoundedQueue<BatchJobPtr> loadedQueue(queueDepth);
+	BoundedQueue<BatchJobPtr> processedQueue(queueDepth);
+	BoundedQueue<BatchJobPtr> encodedQueue(queueDepth);
+
+	const unsigned int maxProcessing = limits.processThreads > 0 ? limits.processThreads : TaskScheduler::get().getNumThreads();
+
+	std::vector<std::thread> threads;
+
+	// decode the source image, and drop anything that can't be processed or whose outputs are already up to date
+	startStage(threads, "load", limits.loadThreads, fileQueue, &loadedQueue,
+		[&params, cache](std::filesystem::path& inFilePath, BatchJobPtr& outJob)
+		{
+			TraceScope traceScope("load", inFilePath);
+			outJob.reset(new BatchJob);
+			outJob->params = params;
+			outJob->params.inFilePath = inFilePath;
+			outJob->storage.srcImg = loadImage(inFilePath);
+			if (!isProcessableImage(outJob->storage.srcImg))
+				return false;
+
+			if (cache)
+			{
+				outJob->cacheKey = ImageCache::computeKey(outJob->params, outJob->storage.srcImg);
+				if (cache->isUpToDate(outJob->params, outJob->cacheKey))
+					return false;
+			}
+			return true;
+		});
+
+	// quantize - this is where the heavy lifting is, so it runs on the scheduler's threads
+	startSchedulerStage(threads, "process", maxProcessing, loadedQueue, processedQueue,
+		[](BatchJobPtr& job, BatchJobPtr& outJob)
+		{
+			TraceScope traceScope("process", job->params.inFilePath);
+			processImage(job->params, job->storage);
+			outJob = std::move(job);
+			return true;
+		});
+
+	// encode every output into memory, then release the image storage since only the encoded buffers are needed from here
+	startStage(threads, "encode", limits.encodeThreads, processedQueue, &encodedQueue,
+		[](BatchJobPtr& job, BatchJobPtr& outJob)
+		{
+			TraceScope traceScope("encode", job->params.inFilePath);
+			job->artifacts = encodeImageArtifacts(job->params, job->storage);
+			job->storage = ProcessImageStorage();
+			outJob = std::move(job);
+			return true;
+		});
+
+	// write out to disk (or rather, hand off to the io queue to do so)
+	startStage<BatchJobPtr, BatchJobPtr>(threads, "write", limits.writeThreads, encodedQueue, nullptr,
+		[cache, batchPack, &ioQueue](BatchJobPtr& job, BatchJobPtr&)
+		{
+			TraceScope traceScope("write", job->params.inFilePath);
+			if (batchPack)
+				writeImageArtifactsToBatchPack(job->params, job->artifacts, *batchPack);
+			else
+				writeImageArtifacts(job->artifacts, ioQueue);
+			if (cache)
+				cache->update(job->params, job->cacheKey, job->artifacts);
+			return false;
+		});
+
+	// feed the pipeline from here - this blocks whenever the load stage falls behind
+	for (const auto& entry : std::filesystem::directory_iterator(inDirPath))
+	{
+		if (is_regular_file(entry.path()))
+		{
+			fileQueue.push(std::filesystem::path(entry.path()));
+		}
+	}
+	fileQueue.close();
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <filesystem>
+
+class ImageCache;
+class IoQueue;
+class PackWriter;
+struct ProcessImageParams;
+
+// concurrency for each stage of the batch pipeline, and how many images may be queued up between stages
+// the number of images alive at once is bounded by the sum of these, no matter how many files are in the directory
+struct BatchPipelineLimits
+{
+	unsigned int loadThreads = 2;
+	unsigned int processThreads = 0; // images processed at once, on the scheduler's threads. 0 means one per scheduler thread
+	unsigned int encodeThreads = 2;
+	unsigned int writeThreads = 2;
+	unsigned int queueDepth = 4;
+};
+
+// process every file in inDirPath, streaming them through load -> quantize -> encode -> write stages
+// if a cache is provided, images whose outputs are already up to date are dropped right after loading
+// if a batch pack is provided, every image's outputs are written into it rather than to their own files,
+// otherwise they're handed off to the io queue
+void processDirectory(const ProcessImageParams& params, const std::filesystem::path& inDirPath, const BatchPipelineLimits& limits,
+	ImageCache* cache, PackWriter* batchPack, IoQueue& ioQueue);
@@ -0,0 +1,232 @@
+#include "Pch.h"
+
+#include "imageArtifacts.h"
+
+#include <Core/taskScheduler.h>
+#include <Core/trace.h>
+#include <Main/imageEncode.h>
+#include <Main/imageNtscFilter.h>
+#include <Main/imageProcess.h>
+#include <Main/packArchive.h>
+
+#include <EASTL/array.h>
+
+namespace
+{
+	// intermediate products that more than one output is built from
+	enum IntermediateFlags : unsigned int
+	{
+		Intermediate_DepalettizedSnesImage = 1 << 0
+	};
+
+	struct ArtifactIntermediates
+	{
+		eastl::vector<unsigned short> depalettizedSnesImage;
+	};
+
+	struct ArtifactContext
+	{
+		const ProcessImageParams& params;
+		const ProcessImageStorage& storage;
+		const ArtifactIntermediates& intermediates;
+
+		std::filesystem::path getOutPath(const char* suffix) const
+		{
+			return params.outDirPath / params.inFilePath.stem().concat(suffix);
+		}
+	};
+
+	// every output, what it's built from, and how to encode it - an output may produce any number of artifacts
+	struct ArtifactNode
+	{
+		const char* traceName;
+		unsigned int output;
+		unsigned int intermediates;
+		void (*encode)(const ArtifactContext& context, ImageArtifactList& outArtifacts);
+	};
+
+	const ArtifactNode ArtifactGraph[] =
+	{
+		// write out 15b quantized source
+		{ "encodeSrcPng", ImageOutput_SrcPng, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "src.png", context.getOutPath("-src.png"), encodeImage(getQuantizedImage(context.storage.srcImg)) });
+		} },
+
+		// write out raw as png
+		{ "encodePng", ImageOutput_Png, Intermediate_DepalettizedSnesImage, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			const auto& palettizedImg = context.storage.palettizedImg;
+			Image depalettizedImg = getImageFromSnesImage(context.intermediates.depalettizedSnesImage, palettizedImg.width, palettizedImg.height);
+			outArtifacts.push_back({ "png", context.getOutPath(".png"), encodeImage(depalettizedImg) });
+		} },
+
+		// write out ntsc-processed png
+		{ "encodeFilteredPng", ImageOutput_FilteredPng, Intermediate_DepalettizedSnesImage, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			const auto& palettizedImg = context.storage.palettizedImg;
+			Image filteredImg = applyNtscFilter(context.intermediates.depalettizedSnesImage, palettizedImg.width, palettizedImg.height);
+			outArtifacts.push_back({ "filtered.png", context.getOutPath("-filtered.png"), encodeImage(filteredImg) });
+		} },
+
+		// write out palette information
+		{ "encodePltIdxPng", ImageOutput_PltIdxPng, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "pltidx.png", context.getOutPath("-pltidx.png"), encodePalettizedImage(context.storage.palettizedImg) });
+		} },
+
+		// write out palette data
+		{ "encodeClr", ImageOutput_Clr, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "clr", context.getOutPath(".clr"), encodeSnesPalette(context.storage.palettizedImg.palette) });
+		} },
+
+		// write out tile data
+		{ "encodePic", ImageOutput_Pic, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "pic", context.getOutPath(".pic"), encodeSnesTiles(context.storage.palettizedImg) });
+		} },
+
+		// write out tilemap data
+		{ "encodeMap", ImageOutput_Map, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "map", context.getOutPath(".map"), encodeSnesTilemap(context.storage.palettizedImg) });
+		} },
+
+		// write out hdma tables
+		{ "encodeHdma", ImageOutput_Hdma, 0, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			const auto& palettizedImg = context.storage.palettizedImg;
+			for (unsigned int i = 0; i < palettizedImg.hdmaTables.size(); ++i)
+			{
+				eastl::string name;
+				name.sprintf("hdma-%d", i);
+				outArtifacts.push_back({ name, getSnesHdmaTablePath(context.getOutPath(".hdma"), i), encodeSnesHdmaTable(palettizedImg, i) });
+			}
+		} },
+
+		// calculate/report stats
+		{ "encodeStats", ImageOutput_Stats, Intermediate_DepalettizedSnesImage, [](const ArtifactContext& context, ImageArtifactList& outArtifacts)
+		{
+			outArtifacts.push_back({ "stats", context.getOutPath(".txt"), encodeImageStatistics(context.storage, context.intermediates.depalettizedSnesImage) });
+		} },
+	};
+
+	const unsigned int NumArtifactNodes = sizeof(ArtifactGraph) / sizeof(ArtifactGraph[0]);
+
+	struct OutputName
+	{
+		const char* name;
+		unsigned int output;
+	};
+
+	const OutputName OutputNames[] =
+	{
+		{ "src", ImageOutput_SrcPng },
+		{ "png", ImageOutput_Png },
+		{ "filtered", ImageOutput_FilteredPng },
+		{ "pltidx", ImageOutput_PltIdxPng },
+		{ "clr", ImageOutput_Clr },
+		{ "pic", ImageOutput_Pic },
+		{ "map", ImageOutput_Map },
+		{ "hdma", ImageOutput_Hdma },
+		{ "stats", ImageOutput_Stats },
+		{ "all", ImageOutput_All },
+	};
+}
+
+ImageArtifactList encodeImageArtifacts(const ProcessImageParams& params, const ProcessImageStorage& storage)
+{
+	// figure out which intermediates are needed by the requested outputs, and build each of them once up front
+	unsigned int neededIntermediates = 0;
+	for (const auto& node : ArtifactGraph)
+	{
+		if (params.outputs & node.output)
+			neededIntermediates |= node.intermediates;
+	}
+
+	ArtifactIntermediates intermediates;
+	if (neededIntermediates & Intermediate_DepalettizedSnesImage)
+	{
+		TraceScope traceScope("depalettize", params.inFilePath);
+		intermediates.depalettizedSnesImage = getDepalettizedSnesImage(storage.palettizedImg);
+	}
+
+	// then run every requested encoder at once, each into its own list
+	ArtifactContext context = { params, storage, intermediates };
+	eastl::array<ImageArtifactList, NumArtifactNodes> nodeArtifacts;
+	{
+		TaskGroup tasks;
+		for (unsigned int i = 0; i < NumArtifactNodes; ++i)
+		{
+			if (params.outputs & ArtifactGraph[i].output)
+			{
+				tasks.run([&context, &nodeArtifacts, i]
+				{
+					TraceScope traceScope(ArtifactGraph[i].traceName, context.params.inFilePath);
+					ArtifactGraph[i].encode(context, nodeArtifacts[i]);
+				});
+			}
+		}
+		tasks.wait();
+	}
+
+	ImageArtifactList artifacts;
+	for (auto& encodedArtifacts : nodeArtifacts)
+	{
+		for (auto& artifact : encodedArtifacts)
+		{
+			artifacts.push_back(eastl::move(artifact));
+		}
+	}
+
+	if (params.outFormat != OutputFormat::Pack)
+		return artifacts;
+
+	// pack everything into a single file for the image
+	ImageArtifact packArtifact = { "pack", context.getOutPath(".bpk"), ByteBuffer() };
+	{
+		PackWriter pack(packArtifact.data);
+		for (const auto& artifact : artifacts)
+		{
+			pack.addSection(artifact.name, artifact.data);
+		}
+		pack.close();
+	}
+
+	ImageArtifactList packedArtifacts;
+	packedArtifacts.push_back(eastl::move(packArtifact));
+	return packedArtifacts;
+}
+
+std::filesystem::path getSnesHdmaTablePath(const std::filesystem::path& file, unsigned int channel)
+{
+	char fileSuffix[8];
+	snprintf(fileSuffix, 8, "-%d", channel);
+	auto localPath = file;
+	localPath.concat(fileSuffix);
+	return localPath;
+}
+
+bool parseImageOutputs(std::string_view outputList, unsigned int& outOutputs)
+{
+	outOutputs = 0;
+	while (!outputList.empty())
+	{
+		size_t separator = outputList.find(',');
+		std::string_view outputName = outputList.substr(0, separator);
+		outputList = separator == std::string_view::npos ? std::string_view() : outputList.substr(separator + 1);
+
+		unsigned int output = 0;
+		for (const auto& name : OutputNames)
+		{
+			if (outputName == name.name)
+				output = name.output;
+		}
+		if (output == 0)
+			return false;
+
+		outOutputs |= output;
+	}
+	return outOutputs != 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+#include <EASTL/string.h>
+
+#include "imageCommon.h"
+
+struct ProcessImageParams;
+
+// a single encoded output file for an image, held in memory until it's written out
+// name identifies the artifact's section when it's written into a pack instead of its own file
+struct ImageArtifact
+{
+	eastl::string name;
+	std::filesystem::path path;
+	ByteBuffer data;
+};
+
+typedef eastl::vector<ImageArtifact> ImageArtifactList;
+
+// encode the outputs requested by params.outputs for a processed image (previews, palette, tiles, tilemap, hdma tables, stats),
+// in parallel. intermediate images that several outputs are built from are only generated once, and only if needed
+// if the params ask for packed output, the artifacts are collapsed down into a single pack artifact for the image
+// the artifacts' paths are only built up from the params' paths; nothing is read from or written to disk
+ImageArtifactList encodeImageArtifacts(const ProcessImageParams& params, const ProcessImageStorage& storage);
+
+// parse a comma-separated list of outputs (src, png, filtered, pltidx, clr, pic, map, hdma, stats, or all) into ImageOutputFlags
+bool parseImageOutputs(std::string_view outputList, unsigned int& outOutputs);
+
+// each hdma channel gets its own file, suffixed with the channel index
+std::filesystem::path getSnesHdmaTablePath(const std::filesystem::path& file, unsigned int channel);
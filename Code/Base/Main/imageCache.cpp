@@ -0,0 +1,165 @@
+#include "Pch.h"
+
+#include "imageCache.h"
+
+#include <Main/imageProcess.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	// bump this whenever a change to the tool would change its outputs, so stale caches are thrown out
+	const char* CacheVersionStamp = "background-processor-cache-2";
+
+	// 64-bit FNV-1a
+	const uint64_t HashOffsetBasis = 0xcbf29ce484222325ull;
+	const uint64_t HashPrime = 0x100000001b3ull;
+
+	uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= HashPrime;
+		}
+		return hash;
+	}
+
+	template<typename T>
+	uint64_t hashValue(uint64_t hash, const T& value)
+	{
+		return hashBytes(hash, &value, sizeof(T));
+	}
+
+	eastl::string getEntryName(const ProcessImageParams& params)
+	{
+		// outputs are named after the input's stem, so that's what entries are keyed on as well
+		return eastl::string(params.inFilePath.stem().generic_string().c_str());
+	}
+}
+
+ImageCache::ImageCache(const std::filesystem::path& manifestPath)
+	: m_manifestPath(manifestPath)
+{
+	std::ifstream manifest(manifestPath);
+	if (!manifest)
+		return;
+
+	// first line must match the version stamp, otherwise the whole manifest is stale
+	std::string line;
+	if (!std::getline(manifest, line) || line != CacheVersionStamp)
+		return;
+
+	// every other line is "<key>\t<entry name>\t<artifact filename>\t<artifact filename>..."
+	while (std::getline(manifest, line))
+	{
+		std::istringstream lineStream(line);
+		std::string field;
+		if (!std::getline(lineStream, field, '\t'))
+			continue;
+
+		CacheEntry entry;
+		entry.key = strtoull(field.c_str(), nullptr, 16);
+		if (!std::getline(lineStream, field, '\t'))
+			continue;
+
+		eastl::string entryName(field.c_str());
+		while (std::getline(lineStream, field, '\t'))
+		{
+			entry.artifactFilenames.push_back(eastl::string(field.c_str()));
+		}
+		m_entries[entryName] = entry;
+	}
+}
+
+uint64_t ImageCache::computeKey(const ProcessImageParams& params, const Image& srcImg)
+{
+	uint64_t hash = hashBytes(HashOffsetBasis, CacheVersionStamp, strlen(CacheVersionStamp));
+	// settings that the params say are ignored are left out, so changing one doesn't throw away identical outputs
+	hash = hashValue(hash, params.lowBitDepthPalette);
+	if (params.lowBitDepthPalette)
+	{
+		hash = hashValue(hash, params.maxPalettes);
+		hash = hashValue(hash, params.tileBitsPerPixel);
+	}
+	else
+	{
+		hash = hashValue(hash, params.maxColors);
+		hash = hashValue(hash, params.maxHdmaChannels);
+		hash = hashValue(hash, params.dither);
+	}
+	if (params.lowBitDepthPalette || params.maxHdmaChannels == 0)
+	{
+		hash = hashValue(hash, params.quantizer);
+		hash = hashValue(hash, params.refineIterations);
+	}
+	hash = hashValue(hash, params.outFormat);
+	hash = hashValue(hash, params.outputs);
+	hash = hashValue(hash, srcImg.width);
+	hash = hashValue(hash, srcImg.height);
+	hash = hashBytes(hash, srcImg.data.data(), srcImg.data.size() * sizeof(Color));
+	return hash;
+}
+
+bool ImageCache::isUpToDate(const ProcessImageParams& params, uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto entryIter = m_entries.find(getEntryName(params));
+	if (entryIter == m_entries.end() || entryIter->second.key != key)
+		return false;
+
+	for (const auto& artifactFilename : entryIter->second.artifactFilenames)
+	{
+		if (!std::filesystem::exists(params.outDirPath / artifactFilename.c_str()))
+			return false;
+	}
+	return true;
+}
+
+void ImageCache::update(const ProcessImageParams& params, uint64_t key, const ImageArtifactList& artifacts)
+{
+	CacheEntry entry;
+	entry.key = key;
+	for (const auto& artifact : artifacts)
+	{
+		entry.artifactFilenames.push_back(eastl::string(artifact.path.filename().generic_string().c_str()));
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_entries[getEntryName(params)] = entry;
+	m_dirty = true;
+}
+
+void ImageCache::save()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!m_dirty)
+		return;
+
+	// write to a temp file and swap it in, so an interrupted run can't leave a truncated manifest behind
+	std::filesystem::path tempPath = m_manifestPath;
+	tempPath.concat(".tmp");
+	{
+		std::ofstream manifest(tempPath, std::ios::trunc);
+		if (!manifest)
+			return;
+
+		manifest << CacheVersionStamp << '\n';
+		for (const auto& entry : m_entries)
+		{
+			manifest << std::hex << entry.second.key << std::dec << '\t' << entry.first.c_str();
+			for (const auto& artifactFilename : entry.second.artifactFilenames)
+			{
+				manifest << '\t' << artifactFilename.c_str();
+			}
+			manifest << '\n';
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, m_manifestPath, error);
+	if (!error)
+		m_dirty = false;
+}
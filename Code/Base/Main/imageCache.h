@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+
+#include <EASTL/hash_map.h>
+#include <EASTL/string.h>
+
+#include "imageArtifacts.h"
+
+struct ProcessImageParams;
+
+// Persistent manifest of what was last generated for every image in an output directory
+// Each image is keyed by a hash of its decoded pixels, the params that affect its outputs, and a version stamp for the tool
+// itself, so if none of those have changed (and the outputs are still on disk) the image doesn't need to be processed again
+class ImageCache
+{
+public:
+	// loads the manifest from disk, if it exists
+	explicit ImageCache(const std::filesystem::path& manifestPath);
+
+	static uint64_t computeKey(const ProcessImageParams& params, const Image& srcImg);
+
+	// true if the outputs recorded for this image were generated from the same key, and they all still exist
+	bool isUpToDate(const ProcessImageParams& params, uint64_t key);
+	void update(const ProcessImageParams& params, uint64_t key, const ImageArtifactList& artifacts);
+
+	void save();
+
+private:
+	struct CacheEntry
+	{
+		uint64_t key;
+		eastl::vector<eastl::string> artifactFilenames;
+	};
+
+	std::filesystem::path m_manifestPath;
+	std::mutex m_lock;
+	eastl::hash_map<eastl::string, CacheEntry> m_entries;
+	bool m_dirty = false;
+};
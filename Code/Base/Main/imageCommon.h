@@ -3,6 +3,8 @@
 #include <EASTL/fixed_vector.h>
 #include <EASTL/vector.h>
 
+typedef eastl::vector<unsigned char> ByteBuffer;
+
 struct Color
 {
 	unsigned char r = 0;
@@ -34,10 +36,43 @@ struct PalettizedImage
 	eastl::fixed_vector<HdmaTable, MaxHdmaChannels, false> hdmaTables;
 	eastl::vector<unsigned char> data;
 	unsigned int width, height;
+	// of the tiles - 8 with a single palette, or 4 (or 2) when every 8x8 tile picks one of several 16c (or 4c) palettes.
+	// either way, data holds indices into the whole palette, and a 4bpp (or 2bpp) tile's palette is the bits above
+	// that in any of its indices
+	unsigned int bitsPerPixel = 8;
+};
+
+// how the outputs for an image get written out
+enum class OutputFormat
+{
+	Files, // one file per output
+	Pack, // one pack file per image
+	PackBatch // one pack file for the whole batch
+};
+
+// which outputs get generated for an image, as a bitmask
+enum ImageOutputFlags : unsigned int
+{
+	ImageOutput_SrcPng = 1 << 0, // 15b quantized source
+	ImageOutput_Png = 1 << 1, // result, as it'd appear on the snes
+	ImageOutput_FilteredPng = 1 << 2, // result, run through the ntsc filter
+	ImageOutput_PltIdxPng = 1 << 3, // palette indices
+	ImageOutput_Clr = 1 << 4, // palette data
+	ImageOutput_Pic = 1 << 5, // tile data
+	ImageOutput_Map = 1 << 6, // tilemap data
+	ImageOutput_Hdma = 1 << 7, // hdma tables
+	ImageOutput_Stats = 1 << 8, // psnr and color count
+	ImageOutput_All = (1 << 9) - 1
 };
 
 struct ProcessImageStorage
 {
 	Image srcImg;
 	PalettizedImage palettizedImg;
-};
\ No newline at end of file
+};
+
+// images that failed to load, or that are too big on either dimension, can't be processed
+inline bool isProcessableImage(const Image& img)
+{
+	return img.data.size() > 0 && img.width <= MaxWidth && img.height <= MaxHeight;
+}
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "Pch.h"
+
+#include <Core/taskScheduler.h>
+#include <Core/trace.h>
+#include <Main/imageProcess.h>
+#include <EASTL/algorithm.h>
+#include <External/EASTL/include/EASTL/set.h>
+
+#include "imageEncode.h"
+
+#define STBI_MSC_SECURE_CRT
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <External/stb/stb_image_write.h>
+
+Image createImageFromPixels(const unsigned char* rgbPixels, unsigned int width, unsigned int height)
+{
+	const unsigned int TileSize = 8;
+	Image img;
+	if (height % TileSize == 0 && width % TileSize == 0)
+	{
+		img.width = width;
+		img.height = height;
+		img.data.resize(img.width * img.height);
+		memcpy(img.data.data(), rgbPixels, img.width * img.height * 3);
+	}
+	else
+	{
+		img.width = (width + TileSize - 1) & ~(TileSize - 1);
+		img.height = (height + TileSize - 1) & ~(TileSize - 1);
+		img.data.resize(img.width * img.height);
+		unsigned int row;
+		for (row = 0; row < height; ++row)
+		{
+			memcpy(&img.data[row * img.width], &rgbPixels[row * width * 3], width * 3);
+		}
+	}
+	return img;
+}
+
+template<typename T>
+void appendToBuffer(ByteBuffer& buffer, const T* data, size_t count)
+{
+	auto oldSize = buffer.size();
+	buffer.resize(oldSize + sizeof(T) * count);
+	memcpy(buffer.data() + oldSize, data, sizeof(T) * count);
+}
+
+ByteBuffer encodePng(const void* data, unsigned int width, unsigned int height, int numComponents)
+{
+	ByteBuffer buffer;
+	buffer.reserve(width * height * (numComponents + 1));
+
+	auto writeFunc = [](void* context, void* data, int size) {
+		appendToBuffer(*static_cast<ByteBuffer*>(context), static_cast<unsigned char*>(data), size);
+	};
+
+	TraceScope traceScope("stbi_write_png_to_func");
+	stbi_write_png_to_func(writeFunc, &buffer, width, height, numComponents, data, 0);
+	return buffer;
+}
+
+ByteBuffer encodeImage(const Image& img)
+{
+	return encodePng(img.data.data(), img.width, img.height, 3);
+}
+
+ByteBuffer encodePalettizedImage(const PalettizedImage& img)
+{
+	return encodePng(img.data.data(), img.width, img.height, 1);
+}
+
+ByteBuffer encodeSnesPalette(const PalettizedImage::PaletteTable& palette)
+{
+	ByteBuffer buffer;
+	appendToBuffer(buffer, palette.data(), palette.size());
+	return buffer;
+}
+
+// snes tiles are planar - every row of a tile is split into a byte per bitplane, with the leftmost px in the top bit.
+// the bitplanes are stored in pairs: every row of the first two interleaved, then every row of the next two, and so on
+template<unsigned int Bpp>
+void encodeSnesTile(const unsigned char* px, unsigned int stride, unsigned char* outTile)
+{
+	for (unsigned int row = 0; row < 8; ++row)
+	{
+		uint64_t rowPx;
+		memcpy(&rowPx, px + row * stride, sizeof(rowPx));
+		for (unsigned int bitplane = 0; bitplane < Bpp; ++bitplane)
+		{
+			// gather the bitplane's bit out of each of the 8 px at once - the multiply shifts each px's bit to its own
+			// place in the top byte (the first px's to the top), and none of the other products overlap them
+			uint64_t bits = (rowPx >> bitplane) & 0x0101010101010101ull;
+			outTile[(bitplane / 2) * 16 + row * 2 + bitplane % 2] = (unsigned char)((bits * 0x8040201008040201ull) >> 56);
+		}
+	}
+}
+
+// the tiles cover the whole image - a partial tile on the right or bottom edge is padded out with px 0. the tiles and
+// the tilemap both go by these, so the empty tile after the last one is numbered the same in each
+unsigned int getSnesTilesWide(const PalettizedImage& img)
+{
+	return (img.width + 7) / 8;
+}
+
+unsigned int getSnesTilesHigh(const PalettizedImage& img)
+{
+	return (img.height + 7) / 8;
+}
+
+template<unsigned int Bpp>
+ByteBuffer encodeSnesTiles(const PalettizedImage& img)
+{
+	const unsigned int TileByteCount = Bpp * 8;
+	unsigned int tilesWide = getSnesTilesWide(img);
+	unsigned int tileCount = tilesWide * getSnesTilesHigh(img);
+
+	// the buffer starts out zeroed, which leaves an empty black tile on the end for the tilemap to fill the screen with
+	ByteBuffer buffer((tileCount + 1) * TileByteCount, 0);
+	TaskGroup tasks;
+	for (unsigned int tileFirst = 0; tileFirst < tileCount; tileFirst += tilesWide)
+	{
+		tasks.run([&img, &buffer, tileFirst, tilesWide]
+		{
+			unsigned int y = (tileFirst / tilesWide) * 8;
+			unsigned int rowCount = eastl::min(8u, img.height - y);
+			for (unsigned int tileIdx = tileFirst; tileIdx < tileFirst + tilesWide; ++tileIdx)
+			{
+				unsigned int x = (tileIdx % tilesWide) * 8;
+				unsigned int colCount = eastl::min(8u, img.width - x);
+				const unsigned char* px = img.data.data() + y * img.width + x;
+				if (rowCount == 8 && colCount == 8)
+				{
+					encodeSnesTile<Bpp>(px, img.width, buffer.data() + tileIdx * TileByteCount);
+					continue;
+				}
+
+				// a partial tile is copied into a whole one first, so every row can still be read as 8 px
+				eastl::array<unsigned char, 8 * 8> paddedPx;
+				paddedPx.fill(0);
+				for (unsigned int row = 0; row < rowCount; ++row)
+				{
+					memcpy(&paddedPx[row * 8], px + row * img.width, colCount);
+				}
+				encodeSnesTile<Bpp>(paddedPx.data(), 8, buffer.data() + tileIdx * TileByteCount);
+			}
+		});
+	}
+	tasks.wait();
+	return buffer;
+}
+
+ByteBuffer encodeSnesTiles(const PalettizedImage& img)
+{
+	// at lower depths, only the bits of each px that index into its tile's palette make it into the tile - the bits
+	// above them pick the palette, which goes in the tilemap
+	switch (img.bitsPerPixel)
+	{
+	case 2: return encodeSnesTiles<2>(img);
+	case 4: return encodeSnesTiles<4>(img);
+	default: return encodeSnesTiles<8>(img);
+	}
+}
+
+ByteBuffer encodeSnesTilemap(const PalettizedImage& img)
+{
+	const unsigned int MaxTiles = (MaxWidth / 8) * (MaxHeight / 8);
+	const unsigned int PaletteShift = 10;
+	unsigned int width = img.width;
+	unsigned int tilesWide = getSnesTilesWide(img);
+	unsigned int tilesHigh = getSnesTilesHigh(img);
+	eastl::fixed_vector<unsigned short, MaxTiles, false> snesTilemap;
+	snesTilemap.resize(MaxTiles, (unsigned short)(tilesWide * tilesHigh));
+	
+	unsigned short tileNumber = 0;
+	for (unsigned int i = 0; i < tilesHigh; ++i)
+	{
+		for (unsigned int j = 0; j < tilesWide; ++j)
+		{
+			// 2bpp and 4bpp tiles pick their palette in the tilemap. every px in the tile is in the same one, so any px will do
+			unsigned short paletteNumber = 0;
+			if (img.bitsPerPixel < 8)
+				paletteNumber = img.data[i * 8 * width + j * 8] >> img.bitsPerPixel;
+			snesTilemap[i * 32 + j] = tileNumber++ | (paletteNumber << PaletteShift);
+		}
+	}
+
+	ByteBuffer buffer;
+	appendToBuffer(buffer, snesTilemap.data(), snesTilemap.size());
+	return buffer;
+}
+
+ByteBuffer encodeSnesHdmaTable(const PalettizedImage& img, unsigned int channel)
+{
+	struct HdmaRow
+	{
+		unsigned char lineCounter; // should never be > 0x7f - "repeat" functionality in export doesn't exist (yet?).
+		const unsigned char dummy = 0; // dummy byte that should be 0 - not used by hdma because it's delivered alongside cgramAddr
+		unsigned char cgramAddr;
+		unsigned char cgramData[2];
+	};
+
+	eastl::fixed_vector<HdmaRow, 224, false> hdmaOutput;
+	const auto& hdmaActions = img.hdmaTables[channel];
+	for (const auto& hdmaAction : hdmaActions)
+	{
+		HdmaRow hdmaRow;
+		hdmaRow.lineCounter = hdmaAction.lineCount;
+		hdmaRow.cgramAddr = hdmaAction.paletteIdx;
+		hdmaRow.cgramData[1] = (unsigned char)((hdmaAction.snesColor & 0x7f00) >> 8);
+		hdmaRow.cgramData[0] = (unsigned char)((hdmaAction.snesColor & 0x00ff) >> 0);
+		hdmaOutput.push_back(hdmaRow);
+	}
+
+	ByteBuffer buffer;
+	appendToBuffer(buffer, hdmaOutput.data(), hdmaOutput.size());
+	return buffer;
+}
+
+ByteBuffer encodeImageStatistics(const ProcessImageStorage& storage)
+{
+	return encodeImageStatistics(storage, getDepalettizedSnesImage(storage.palettizedImg));
+}
+
+ByteBuffer encodeImageStatistics(const ProcessImageStorage& storage, const eastl::vector<unsigned short>& depalettizedSnesImg)
+{
+	double psnr = 0;
+	{
+		// calculate PSNR
+		const auto& outputData = depalettizedSnesImg;
+
+		double totalError = 0;
+		unsigned int numPx = (unsigned int)outputData.size();
+		for (unsigned int idx = 0; idx < numPx; ++idx)
+		{
+			Color origColor = storage.srcImg.data[idx];
+			unsigned short newColor = outputData[idx];
+			int deltaR = ((origColor.r & 0xf8) >> 3) - ((newColor & 0x001f) >> 0);
+			int deltaG = ((origColor.g & 0xf8) >> 3) - ((newColor & 0x03e0) >> 5);
+			int deltaB = ((origColor.b & 0xf8) >> 3) - ((newColor & 0x7c00) >> 10);
+
+			totalError += (deltaR * deltaR) + (deltaG * deltaG) + (deltaB * deltaB);
+		}
+		totalError /= (numPx * 3);
+		
+		double maxError = (1 << 5) - 1;
+
+		psnr = totalError > 0 ? 20 * log10(maxError) - 10 * log10(totalError) : 0.0;
+	}
+
+	unsigned int numColors = 0;
+	{
+		// calculate total # of colors in img, across palette and all hdma actions
+		eastl::set<unsigned short> colorSet;
+
+		for (const auto& plt : storage.palettizedImg.palette)
+		{
+			colorSet.insert(plt);
+		}
+
+		for (const auto& hdmaTable : storage.palettizedImg.hdmaTables)
+		{
+			for (const auto& hdmaAction : hdmaTable)
+			{
+				colorSet.insert(hdmaAction.snesColor);
+			}
+		}
+		numColors = (unsigned int)colorSet.size();
+	}
+
+	char output[512];
+	snprintf(output, 512, "PSNR: %f dB\r\nNumColors: %d\r\n", psnr, numColors);
+	
+	ByteBuffer buffer;
+	appendToBuffer(buffer, output, strlen(output));
+	return buffer;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "imageCommon.h"
+
+// copy 8-bit rgb pixels into an image, padding it out with black to a whole number of 8x8 tiles if needed
+Image createImageFromPixels(const unsigned char* rgbPixels, unsigned int width, unsigned int height);
+
+// encoders - these produce the contents of each output file in memory
+ByteBuffer encodeImage(const Image& img);
+ByteBuffer encodePalettizedImage(const PalettizedImage& pltImg);
+ByteBuffer encodeSnesPalette(const PalettizedImage::PaletteTable& palette);
+ByteBuffer encodeSnesTiles(const PalettizedImage& img);
+ByteBuffer encodeSnesTilemap(const PalettizedImage& img);
+ByteBuffer encodeSnesHdmaTable(const PalettizedImage& img, unsigned int channel);
+ByteBuffer encodeImageStatistics(const ProcessImageStorage& storage);
+ByteBuffer encodeImageStatistics(const ProcessImageStorage& storage, const eastl::vector<unsigned short>& depalettizedSnesImg);
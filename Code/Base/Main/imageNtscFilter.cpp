@@ -2,6 +2,8 @@
 
 #include "imageNtscFilter.h"
 
+#include <Base/Core/taskScheduler.h>
+#include <Base/Core/trace.h>
 #include <Base/Main/imageProcess.h>
 #include <EASTL/vector.h>
 #include <External/blargg_ntsc/snes_ntsc.h>
@@ -13,34 +15,50 @@ struct SnesNtscObject
 	SnesNtscObject()
 	{
 		m_ntscConfig = new snes_ntsc_t;
-		
-		m_configTask.run([ntscConfig = this->m_ntscConfig]()
+	}
+
+	// the setup task is deferred until here, rather than the constructor, so it goes to the
+	// scheduler after main has had a chance to configure it
+	void beginSetup()
+	{
+		std::call_once(m_setupFlag, [this]()
 		{
-			snes_ntsc_setup_t setup = snes_ntsc_svideo;
-			snes_ntsc_init(ntscConfig, &setup);
+			m_configTask.run([ntscConfig = this->m_ntscConfig]()
+			{
+				TraceScope traceScope("snes_ntsc_init");
+				snes_ntsc_setup_t setup = snes_ntsc_svideo;
+				snes_ntsc_init(ntscConfig, &setup);
+			});
 		});
 	}
 
 	snes_ntsc_t const* getNtscConfig()
 	{
+		beginSetup();
 		m_configTask.wait();
 		return m_ntscConfig;
 	}
 private:
-	Concurrency::task_group m_configTask;
+	std::once_flag m_setupFlag;
+	TaskGroup m_configTask;
 	snes_ntsc_t* m_ntscConfig;
 };
 
 static SnesNtscObject s_snesNtscObj;
 
+void initNtscFilter()
+{
+	s_snesNtscObj.beginSetup();
+}
+
 Image applyNtscFilter(const PalettizedImage& palettizedImg)
 {
 	// prep the data for input into the ntsc filter
-	auto width = palettizedImg.width;
-	auto height = palettizedImg.height;
-
-	eastl::vector<unsigned short> snesImgData = getDepalettizedSnesImage(palettizedImg);
+	return applyNtscFilter(getDepalettizedSnesImage(palettizedImg), palettizedImg.width, palettizedImg.height);
+}
 
+Image applyNtscFilter(const eastl::vector<unsigned short>& snesImgData, unsigned int width, unsigned int height)
+{
 	// run the filter
 	eastl::vector<char> filteredData;
 	unsigned int outImgWidth = SNES_NTSC_OUT_WIDTH(width);
@@ -2,5 +2,9 @@
 
 #include "imageCommon.h"
 
+// kick off building the ntsc filter's tables in the background, so they're ready by the time the first image is filtered
+void initNtscFilter();
 Image applyNtscFilter(const PalettizedImage& palettizedImg);
+// filter an already-depalettized snes image (i.e. from getDepalettizedSnesImage)
+Image applyNtscFilter(const eastl::vector<unsigned short>& snesImgData, unsigned int width, unsigned int height);
 
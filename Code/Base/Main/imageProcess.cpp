@@ -3,16 +3,91 @@
 #include "imageprocess.h"
 #include "imageProcessIspc_ispc.h"
 
+#include <Core/indexedHeap.h>
+#include <Core/taskScheduler.h>
+#include <Core/trace.h>
+
+#include <EASTL/algorithm.h>
 #include <EASTL/array.h>
 #include <EASTL/bonus/tuple_vector.h>
-#include <EASTL/numeric.h>
 #include <EASTL/sort.h>
 #include <EASTL/utility.h>
 
+#include <atomic>
+
 using namespace eastl;
 
+// the ispc kernels treat image data as tightly packed rgb bytes
+static_assert(sizeof(Color) == 3, "Color must be 3 packed bytes");
+
+// the ispc kernels are built for several targets (see CMakeLists.txt), and by default ispc's dispatch picks the best
+// one the cpu supports. each target's kernels are also exported with the target's isa as a suffix, which is what
+// gets called when a target is forced
+namespace ispc
+{
+extern "C"
+{
+	decltype(minmaxUint8) minmaxUint8_sse2, minmaxUint8_sse4, minmaxUint8_avx2, minmaxUint8_avx512skx;
+	decltype(markScanlines) markScanlines_sse2, markScanlines_sse4, markScanlines_avx2, markScanlines_avx512skx;
+	decltype(sumUint8) sumUint8_sse2, sumUint8_sse4, sumUint8_avx2, sumUint8_avx512skx;
+	decltype(scatterPaletteIndex) scatterPaletteIndex_sse2, scatterPaletteIndex_sse4, scatterPaletteIndex_avx2, scatterPaletteIndex_avx512skx;
+	decltype(remapToPalette) remapToPalette_sse2, remapToPalette_sse4, remapToPalette_avx2, remapToPalette_avx512skx;
+	decltype(quantizeRgb) quantizeRgb_sse2, quantizeRgb_sse4, quantizeRgb_avx2, quantizeRgb_avx512skx;
+	decltype(snesToRgb) snesToRgb_sse2, snesToRgb_sse4, snesToRgb_avx2, snesToRgb_avx512skx;
+	decltype(depalettizeScanline) depalettizeScanline_sse2, depalettizeScanline_sse4, depalettizeScanline_avx2, depalettizeScanline_avx512skx;
+	decltype(findNearestPaletteColors) findNearestPaletteColors_sse2, findNearestPaletteColors_sse4, findNearestPaletteColors_avx2, findNearestPaletteColors_avx512skx;
+	decltype(ditherScanlineOrdered) ditherScanlineOrdered_sse2, ditherScanlineOrdered_sse4, ditherScanlineOrdered_avx2, ditherScanlineOrdered_avx512skx;
+}
+}
+
+enum class IspcTarget
+{
+	Auto,
+	Sse2,
+	Sse4,
+	Avx2,
+	Avx512Skx,
+};
+static std::atomic<IspcTarget> s_ispcTarget{ IspcTarget::Auto };
+
+template<typename Kernel>
+Kernel* selectIspcKernel(Kernel* autoKernel, Kernel* sse2Kernel, Kernel* sse4Kernel, Kernel* avx2Kernel, Kernel* avx512SkxKernel)
+{
+	switch (s_ispcTarget.load(std::memory_order_relaxed))
+	{
+	case IspcTarget::Sse2: return sse2Kernel;
+	case IspcTarget::Sse4: return sse4Kernel;
+	case IspcTarget::Avx2: return avx2Kernel;
+	case IspcTarget::Avx512Skx: return avx512SkxKernel;
+	default: return autoKernel;
+	}
+}
+#define ISPC_KERNEL(kernel) selectIspcKernel(ispc::kernel, ispc::kernel##_sse2, ispc::kernel##_sse4, ispc::kernel##_avx2, ispc::kernel##_avx512skx)
+
+bool setIspcTarget(std::string_view target)
+{
+	if (target == "auto")
+		s_ispcTarget = IspcTarget::Auto;
+	else if (target == "sse2")
+		s_ispcTarget = IspcTarget::Sse2;
+	else if (target == "sse4")
+		s_ispcTarget = IspcTarget::Sse4;
+	else if (target == "avx2")
+		s_ispcTarget = IspcTarget::Avx2;
+	else if (target == "avx512skx")
+		s_ispcTarget = IspcTarget::Avx512Skx;
+	else
+		return false;
+	return true;
+}
+
 void quantizeToSinglePalette(const ProcessImageParams& params, ProcessImageStorage& out);
 void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessImageStorage& out);
+void quantizeToSinglePaletteWithWu(const ProcessImageParams& params, ProcessImageStorage& out);
+void refineSinglePalette(const ProcessImageParams& params, ProcessImageStorage& out);
+void quantizeToTilePalettes(const ProcessImageParams& params, ProcessImageStorage& out);
+void remapToNearestLiveColors(ProcessImageStorage& out);
+void ditherToLiveColors(const ProcessImageParams& params, ProcessImageStorage& out);
 
 void updateHdmaAndPalette(const PalettizedImage::HdmaTable &hdmaTable, PalettizedImage::PaletteTable &activePalette, unsigned char &hdmaLineCounter, unsigned int &hdmaRowIdx)
 {
@@ -32,34 +107,17 @@ void updateHdmaAndPalette(const PalettizedImage::HdmaTable &hdmaTable, Palettize
 }
 
 Image getDepalettizedImage(const PalettizedImage& palettizedImg)
+{
+	return getImageFromSnesImage(getDepalettizedSnesImage(palettizedImg), palettizedImg.width, palettizedImg.height);
+}
+
+Image getImageFromSnesImage(const eastl::vector<unsigned short>& snesImgData, unsigned int width, unsigned int height)
 {
 	Image newImg;
-	newImg.width = palettizedImg.width;
-	newImg.height = palettizedImg.height;
+	newImg.width = width;
+	newImg.height = height;
 	newImg.data.resize(newImg.width * newImg.height);
-	auto palImgIter = palettizedImg.data.begin();
-	auto newImgIter = newImg.data.begin();
-
-	eastl::fixed_vector<unsigned int, 8, false> hdmaRowIndices(palettizedImg.hdmaTables.size(), 0);
-	eastl::fixed_vector<unsigned char, 8, false> hdmaLineCounters(palettizedImg.hdmaTables.size(), 0);
-	PalettizedImage::PaletteTable localPalette = palettizedImg.palette;
-	for (unsigned int i = 0; i < newImg.height; ++i)
-	{
-		for (unsigned int i = 0; i < palettizedImg.hdmaTables.size(); ++i)
-		{
-			updateHdmaAndPalette(palettizedImg.hdmaTables[i], localPalette, hdmaLineCounters[i], hdmaRowIndices[i]);
-		}
-
-		for (unsigned int j = 0; j < newImg.width; ++j, ++newImgIter, ++palImgIter)
-		{
-			unsigned short snesCol = localPalette[(*palImgIter)];
-			Color col;
-			col.r = (snesCol & 0x001f) << 3;
-			col.g = (snesCol & 0x03e0) >> 2;
-			col.b = (snesCol & 0x7c00) >> 7;
-			(*newImgIter) = col;
-		}
-	}
+	ISPC_KERNEL(snesToRgb)((uint16_t*)snesImgData.data(), (int)snesImgData.size(), (uint8_t*)newImg.data.data());
 
 	return newImg;
 }
@@ -70,8 +128,6 @@ eastl::vector<unsigned short> getDepalettizedSnesImage(const PalettizedImage& pa
 	unsigned int width = palettizedImg.width;
 	unsigned int height = palettizedImg.height;
 	snesImgData.resize(palettizedImg.data.size());
-	auto palImgIter = palettizedImg.data.begin();
-	auto snesImgIter = snesImgData.begin();
 
 	eastl::fixed_vector<unsigned int, 8, false> hdmaRowIndices(palettizedImg.hdmaTables.size(), 0);
 	eastl::fixed_vector<unsigned char, 8, false> hdmaLineCounters(palettizedImg.hdmaTables.size(), 0);
@@ -83,10 +139,8 @@ eastl::vector<unsigned short> getDepalettizedSnesImage(const PalettizedImage& pa
 			updateHdmaAndPalette(palettizedImg.hdmaTables[i], localPalette, hdmaLineCounters[i], hdmaRowIndices[i]);
 		}
 
-		for (unsigned int j = 0; j < width; ++j, ++snesImgIter, ++palImgIter)
-		{
-			(*snesImgIter) = localPalette[(*palImgIter)];
-		}
+		// the palette only changes between scanlines, so each scanline is a straight lookup
+		ISPC_KERNEL(depalettizeScanline)((uint8_t*)palettizedImg.data.data() + i * width, (int)width, localPalette.data(), snesImgData.data() + i * width);
 	}
 
 	return snesImgData;
@@ -99,32 +153,172 @@ Image getQuantizedImage(const Image& srcImg)
 	newImg.width = srcImg.width;
 	newImg.height = srcImg.height;
 	newImg.data.resize(srcImg.data.size());
-	auto newImgIter = newImg.data.begin();
-	for (auto color : srcImg.data)
-	{
-		color.r &= 0xf8;
-		color.g &= 0xf8;
-		color.b &= 0xf8;
-		(*newImgIter) = color;
-		++newImgIter;
-	}
+	ISPC_KERNEL(quantizeRgb)((uint8_t*)srcImg.data.data(), (uint8_t*)newImg.data.data(), (int)(srcImg.data.size() * sizeof(Color)));
 	return newImg;
 }
 
 void processImage(const ProcessImageParams& params, ProcessImageStorage& out)
 {
+	// storage may be reused between images, so make sure nothing from a previous image is left behind
+	out.palettizedImg.hdmaTables.clear();
+	out.palettizedImg.bitsPerPixel = 8;
+
+	// tiles each pick their own palette, so there's no single palette to dither against or remap to
+	if (params.lowBitDepthPalette)
+	{
+		TraceScope traceScope("quantizeToTilePalettes", params.inFilePath);
+		quantizeToTilePalettes(params, out);
+		return;
+	}
+
 	if (params.maxHdmaChannels > 0)
 	{
+		TraceScope traceScope("quantizeToSinglePaletteWithHdma", params.inFilePath);
 		quantizeToSinglePaletteWithHdma(params, out);
 	}
 	else
 	{
-		quantizeToSinglePalette(params, out);
+		if (params.quantizer == Quantizer::Wu)
+		{
+			TraceScope traceScope("quantizeToSinglePaletteWithWu", params.inFilePath);
+			quantizeToSinglePaletteWithWu(params, out);
+		}
+		else
+		{
+			TraceScope traceScope("quantizeToSinglePalette", params.inFilePath);
+			quantizeToSinglePalette(params, out);
+		}
+
+		if (params.refineIterations > 0)
+		{
+			TraceScope traceScope("refineSinglePalette", params.inFilePath);
+			refineSinglePalette(params, out);
+		}
+	}
+
+	// dithering maps every px to the colors live on its scanline anyway, so there's no need to remap them first
+	if (params.dither != Dither::None)
+	{
+		TraceScope traceScope("ditherToLiveColors", params.inFilePath);
+		ditherToLiveColors(params, out);
+	}
+	else if (params.maxHdmaChannels > 0)
+	{
+		TraceScope traceScope("remapToNearestLiveColors", params.inFilePath);
+		remapToNearestLiveColors(out);
+	}
+}
+
+bool parseQuantizer(std::string_view name, Quantizer& outQuantizer)
+{
+	if (name == "mediancut")
+		outQuantizer = Quantizer::MedianCut;
+	else if (name == "wu")
+		outQuantizer = Quantizer::Wu;
+	else
+		return false;
+	return true;
+}
+
+bool parseDither(std::string_view name, Dither& outDither)
+{
+	if (name == "none")
+		outDither = Dither::None;
+	else if (name == "bayer4")
+		outDither = Dither::Bayer4;
+	else if (name == "bayer8")
+		outDither = Dither::Bayer8;
+	else if (name == "fs")
+		outDither = Dither::FloydSteinberg;
+	else if (name == "atkinson")
+		outDither = Dither::Atkinson;
+	else
+		return false;
+	return true;
+}
+
+// find which channel has the most (perceptually weighted) variance across a bucket's color bounds, to split the bucket along
+void pickSplitChannel(const Color& lowestChannels, const Color& highestChannels, int& deltaColor, int& channelDelta, unsigned char& midColor)
+{
+	float midR = (highestChannels.r + lowestChannels.r) / 2.0f;
+	int deltaR = (unsigned int)sqrt(pow(highestChannels.r - lowestChannels.r, 2.0f) * (2.0f + midR / 256.0f));
+	int deltaG = (unsigned int)sqrt(pow(highestChannels.g - lowestChannels.g, 2.0f) * 4.0f);
+	int deltaB = (unsigned int)sqrt(pow(highestChannels.b - lowestChannels.b, 2.0f) * (2.0f + (255.0f - midR) / 256.0f));
+
+	if (deltaR >= deltaG && deltaR >= deltaB)
+	{
+		midColor = (highestChannels.r + lowestChannels.r) / 2;
+		deltaColor = deltaR;
+		channelDelta = 0;
+	}
+	else if (deltaG >= deltaR && deltaG >= deltaB)
+	{
+		midColor = (highestChannels.g + lowestChannels.g) / 2;
+		deltaColor = deltaG;
+		channelDelta = 1;
+	}
+	else
+	{
+		midColor = (highestChannels.b + lowestChannels.b) / 2;
+		deltaColor = deltaB;
+		channelDelta = 2;
 	}
 }
 
-typedef tuple_vector<unsigned char, unsigned char, unsigned char, unsigned int> IndexedImageData;
+unsigned short getSnesColor(unsigned char r, unsigned char g, unsigned char b)
+{
+	return ((b & 0xf8) << 7) | ((g & 0xf8) << 2) | ((r & 0xf8) >> 3);
+}
+
+// a palette color as it'll be displayed, for comparing against source pixels
+Color getColorFromSnesColor(unsigned short snesColor)
+{
+	return { (unsigned char)((snesColor & 0x001f) << 3), (unsigned char)((snesColor & 0x03e0) >> 2), (unsigned char)((snesColor & 0x7c00) >> 7) };
+}
+
+// r, g, b, the pixel's index in the source image, and the scanline it's on - kept alongside the index so nothing that
+// looks at where a pixel sits has to divide by the image width
+typedef tuple_vector<unsigned char, unsigned char, unsigned char, unsigned int, unsigned char> IndexedImageData;
 typedef IndexedImageData::iterator IndexedImageDataIterator;
+
+// everything a bucket needs to know about its pixels, which can all be gathered in a single pass over them
+struct IndexedImageBucketStats
+{
+	Color lowestChannels{ 255,255,255 };
+	Color highestChannels{ 0,0,0 };
+	unsigned int accumulatedR = 0;
+	unsigned int accumulatedG = 0;
+	unsigned int accumulatedB = 0;
+	unsigned int pxCount = 0;
+	// a bit for every scanline with at least one of the bucket's pixels on it
+	eastl::array<uint64_t, (MaxHeight + 63) / 64> scanlineMask = {};
+
+	void addPixel(unsigned char r, unsigned char g, unsigned char b, unsigned int scanline)
+	{
+		lowestChannels.r = min(lowestChannels.r, r);
+		lowestChannels.g = min(lowestChannels.g, g);
+		lowestChannels.b = min(lowestChannels.b, b);
+		highestChannels.r = max(highestChannels.r, r);
+		highestChannels.g = max(highestChannels.g, g);
+		highestChannels.b = max(highestChannels.b, b);
+		accumulatedR += r;
+		accumulatedG += g;
+		accumulatedB += b;
+		++pxCount;
+		markScanline(scanline);
+	}
+
+	void markScanline(unsigned int scanline)
+	{
+		scanlineMask[scanline / 64] |= 1ull << (scanline % 64);
+	}
+
+	bool isScanlineMarked(unsigned int scanline) const
+	{
+		return (scanlineMask[scanline / 64] & (1ull << (scanline % 64))) != 0;
+	}
+};
+
 struct IndexedImageBucketRange
 {
 	unsigned char scanlineFirst, scanlineLast, scanlineGapSize, scanlineGapEnd;
@@ -133,47 +327,56 @@ struct IndexedImageBucketRange
 	int deltaColor;
 	int channelDelta;
 	unsigned char midColor;
+	unsigned int accumulatedR, accumulatedG, accumulatedB;
+	unsigned int pxCount;
 
-	void setBucketRange(IndexedImageDataIterator _begin, IndexedImageDataIterator _end, unsigned int width)
+	// gather the stats for a range from scratch - only needed for the initial bucket, since splits gather them for both halves
+	void setBucketRange(IndexedImageDataIterator _begin, IndexedImageDataIterator _end)
 	{
-		begin = _begin;
-		end = _end;
-
-		// find which channel has most variance, and mark which scanlines contain a pixel in this bucket
+		IndexedImageBucketStats stats;
 		eastl::array<bool, MaxHeight> pxOnScanline;
 		pxOnScanline.fill(false);
+
+		int pxCount = (int)distance(_begin, _end);
+		ISPC_KERNEL(minmaxUint8)(&get<0>(*_begin), pxCount, stats.lowestChannels.r, stats.highestChannels.r);
+		ISPC_KERNEL(minmaxUint8)(&get<1>(*_begin), pxCount, stats.lowestChannels.g, stats.highestChannels.g);
+		ISPC_KERNEL(minmaxUint8)(&get<2>(*_begin), pxCount, stats.lowestChannels.b, stats.highestChannels.b);
+		ISPC_KERNEL(markScanlines)(&get<4>(*_begin), pxCount, (int8_t*)pxOnScanline.data(), scanlineFirst, scanlineLast);
+		for (unsigned int i = 0; i < MaxHeight; ++i)
 		{
-			Color lowestChannels{ 255,255,255 };
-			Color highestChannels{ 0,0,0 };
+			if (pxOnScanline[i])
+				stats.markScanline(i);
+		}
 
-			int pxCount = (int)distance(_begin, _end);
-			ispc::minmaxUint8(&get<0>(*_begin), pxCount, lowestChannels.r, highestChannels.r);
-			ispc::minmaxUint8(&get<1>(*_begin), pxCount, lowestChannels.g, highestChannels.g);
-			ispc::minmaxUint8(&get<2>(*_begin), pxCount, lowestChannels.b, highestChannels.b);
-			ispc::markScanlines(&get<unsigned int&>(*_begin), pxCount, (int8_t*)pxOnScanline.data(), width, scanlineFirst, scanlineLast);
+		stats.accumulatedR = ISPC_KERNEL(sumUint8)(&get<0>(*_begin), pxCount);
+		stats.accumulatedG = ISPC_KERNEL(sumUint8)(&get<1>(*_begin), pxCount);
+		stats.accumulatedB = ISPC_KERNEL(sumUint8)(&get<2>(*_begin), pxCount);
+		stats.pxCount = pxCount;
 
-			float midR = (highestChannels.r + lowestChannels.r) / 2.0f;
-			int deltaR = (unsigned int)sqrt(pow(highestChannels.r - lowestChannels.r, 2.0f) * (2.0f + midR / 256.0f));
-			int deltaG = (unsigned int)sqrt(pow(highestChannels.g - lowestChannels.g, 2.0f) * 4.0f);
-			int deltaB = (unsigned int)sqrt(pow(highestChannels.b - lowestChannels.b, 2.0f) * (2.0f + (255.0f - midR) / 256.0f));
+		setBucketRange(_begin, _end, stats);
+	}
 
-			if (deltaR >= deltaG && deltaR >= deltaB)
-			{
-				midColor = (highestChannels.r + lowestChannels.r) / 2;
-				deltaColor = deltaR;
-				channelDelta = 0;
-			}
-			else if (deltaG >= deltaR && deltaG >= deltaB)
-			{
-				midColor = (highestChannels.g + lowestChannels.g) / 2;
-				deltaColor = deltaG;
-				channelDelta = 1;
-			}
-			else
+	void setBucketRange(IndexedImageDataIterator _begin, IndexedImageDataIterator _end, const IndexedImageBucketStats& stats)
+	{
+		begin = _begin;
+		end = _end;
+		accumulatedR = stats.accumulatedR;
+		accumulatedG = stats.accumulatedG;
+		accumulatedB = stats.accumulatedB;
+		pxCount = stats.pxCount;
+
+		// find which channel has most variance
+		pickSplitChannel(stats.lowestChannels, stats.highestChannels, deltaColor, channelDelta, midColor);
+
+		// and which scanlines contain a pixel in this bucket
+		scanlineFirst = (unsigned char)MaxHeight;
+		scanlineLast = 0;
+		for (unsigned int i = 0; i < MaxHeight; ++i)
+		{
+			if (stats.isScanlineMarked(i))
 			{
-				midColor = (highestChannels.b + lowestChannels.b) / 2;
-				deltaColor = deltaB;
-				channelDelta = 2;
+				scanlineFirst = (unsigned char)min((unsigned int)scanlineFirst, i);
+				scanlineLast = (unsigned char)i;
 			}
 		}
 
@@ -183,9 +386,9 @@ struct IndexedImageBucketRange
 			unsigned char largestRunningGapEnd = 0;
 			unsigned char runningGap = 0;
 
-			for (unsigned char i = scanlineFirst; i != scanlineLast; ++i)
+			for (unsigned char i = scanlineFirst; i < scanlineLast; ++i)
 			{
-				if (pxOnScanline[i])
+				if (stats.isScanlineMarked(i))
 				{
 					if (runningGap > largestRunningGap)
 					{
@@ -205,102 +408,757 @@ struct IndexedImageBucketRange
 		}
 	}
 
-	unsigned short getAverageColor()
+	// partition the bucket's pixels so that every pixel pred(r, g, b, scanline) holds for comes first, gathering the stats
+	// for both halves along the way, so neither half has to be rescanned. returns where the second half begins
+	template<typename Pred>
+	IndexedImageDataIterator partition(Pred pred, IndexedImageBucketStats& outFirstStats, IndexedImageBucketStats& outSecondStats)
 	{
-		long accumulatedR = 0;
-		long accumulatedG = 0;
-		long accumulatedB = 0;
-		for (auto pxIter = begin; pxIter != end; ++pxIter)
+		// work on the raw columns - every pixel is visited exactly once, either as it's found to already be on the
+		// right side, or as it's swapped over to it
+		unsigned char* r = &get<0>(*begin);
+		unsigned char* g = &get<1>(*begin);
+		unsigned char* b = &get<2>(*begin);
+		unsigned int* pxIdx = &get<3>(*begin);
+		unsigned char* scanline = &get<4>(*begin);
+		auto addPixel = [r, g, b, scanline](IndexedImageBucketStats& stats, size_t i)
+		{
+			stats.addPixel(r[i], g[i], b[i], scanline[i]);
+		};
+
+		size_t first = 0;
+		size_t last = (size_t)distance(begin, end);
+		while (true)
 		{
-			accumulatedR += get<0>(*pxIter);
-			accumulatedG += get<1>(*pxIter);
-			accumulatedB += get<2>(*pxIter);
+			while (first < last && pred(r[first], g[first], b[first], scanline[first]))
+			{
+				addPixel(outFirstStats, first);
+				++first;
+			}
+			while (first < last && !pred(r[last - 1], g[last - 1], b[last - 1], scanline[last - 1]))
+			{
+				addPixel(outSecondStats, last - 1);
+				--last;
+			}
+			if (first >= last)
+				break;
+
+			--last;
+			eastl::swap(r[first], r[last]);
+			eastl::swap(g[first], g[last]);
+			eastl::swap(b[first], b[last]);
+			eastl::swap(pxIdx[first], pxIdx[last]);
+			eastl::swap(scanline[first], scanline[last]);
+			addPixel(outFirstStats, first);
+			addPixel(outSecondStats, last);
+			++first;
 		}
+		return begin + first;
+	}
 
-		size_t bucketSize = distance(begin, end);
-		unsigned short snesB = ((unsigned short(accumulatedB / bucketSize) & 0xf8) << 7);
-		unsigned short snesG = ((unsigned short(accumulatedG / bucketSize) & 0xf8) << 2);
-		unsigned short snesR = ((unsigned short(accumulatedR / bucketSize) & 0xf8) >> 3);
-		return (snesB | snesG | snesR);
+	unsigned short getAverageColor() const
+	{
+		return getSnesColor((unsigned char)(accumulatedR / pxCount), (unsigned char)(accumulatedG / pxCount), (unsigned char)(accumulatedB / pxCount));
+	}
+
+	void applyPaletteIndex(eastl::vector<unsigned char>& data, unsigned char paletteIdx)
+	{
+		ISPC_KERNEL(scatterPaletteIndex)(&get<3>(*begin), (int)distance(begin, end), data.data(), paletteIdx);
+	}
+};
+
+// bucket priorities for the split heaps - ties go to the earliest bucket, so splits happen in a stable order
+template<typename BucketRanges>
+auto makeDeltaColorCompare(const BucketRanges& bucketRanges)
+{
+	return [&bucketRanges](unsigned int a, unsigned int b)
+	{
+		int deltaA = bucketRanges[a].deltaColor;
+		int deltaB = bucketRanges[b].deltaColor;
+		return deltaA < deltaB || (deltaA == deltaB && a > b);
+	};
+}
+
+// a unique 15-bit color in the source image, and every pixel that quantizes down to it
+struct HistogramColor
+{
+	// channels quantized down to 5 bits, kept in the top bits so they're comparable with 8-bit channels
+	unsigned char r, g, b;
+	unsigned short snesColor;
+	unsigned int pxCount;
+	// the original 8-bit channels of every pixel summed up, so averages aren't skewed by the quantization
+	unsigned int accumulatedR, accumulatedG, accumulatedB;
+
+	unsigned char getChannel(int channel) const
+	{
+		return channel == 0 ? r : (channel == 1 ? g : b);
+	}
+};
+
+typedef vector<HistogramColor> ColorHistogram;
+typedef ColorHistogram::iterator ColorHistogramIterator;
+struct HistogramBucketRange
+{
+	ColorHistogramIterator begin;
+	ColorHistogramIterator end;
+	int deltaColor;
+	int channelDelta;
+	unsigned char midColor;
+
+	void setBucketRange(ColorHistogramIterator _begin, ColorHistogramIterator _end)
+	{
+		begin = _begin;
+		end = _end;
+
+		Color lowestChannels{ 255,255,255 };
+		Color highestChannels{ 0,0,0 };
+		for (auto colorIter = begin; colorIter != end; ++colorIter)
+		{
+			lowestChannels.r = min(lowestChannels.r, colorIter->r);
+			lowestChannels.g = min(lowestChannels.g, colorIter->g);
+			lowestChannels.b = min(lowestChannels.b, colorIter->b);
+			highestChannels.r = max(highestChannels.r, colorIter->r);
+			highestChannels.g = max(highestChannels.g, colorIter->g);
+			highestChannels.b = max(highestChannels.b, colorIter->b);
+		}
+		pickSplitChannel(lowestChannels, highestChannels, deltaColor, channelDelta, midColor);
+	}
+
+	unsigned short getAverageColor() const
+	{
+		unsigned long long accumulatedR = 0;
+		unsigned long long accumulatedG = 0;
+		unsigned long long accumulatedB = 0;
+		unsigned long long pxCount = 0;
+		for (auto colorIter = begin; colorIter != end; ++colorIter)
+		{
+			accumulatedR += colorIter->accumulatedR;
+			accumulatedG += colorIter->accumulatedG;
+			accumulatedB += colorIter->accumulatedB;
+			pxCount += colorIter->pxCount;
+		}
+
+		return getSnesColor((unsigned char)(accumulatedR / pxCount), (unsigned char)(accumulatedG / pxCount), (unsigned char)(accumulatedB / pxCount));
+	}
+};
+
+void quantizeToSinglePalette(const ProcessImageParams& params, ProcessImageStorage& out)
+{
+	// the output can only ever hold 15-bit colors, so collapse the image down to a histogram of the unique 15-bit
+	// colors in it - the median cut then only ever touches each unique color, rather than each pixel
+	const unsigned int NumSnesColors = 1 << 15;
+	const unsigned int InvalidHistogramIdx = ~0u;
+	vector<unsigned int> histogramIndices(NumSnesColors, InvalidHistogramIdx);
+	ColorHistogram histogram;
+	for (auto px : out.srcImg.data)
+	{
+		unsigned short snesColor = getSnesColor(px.r, px.g, px.b);
+		unsigned int& histogramIdx = histogramIndices[snesColor];
+		if (histogramIdx == InvalidHistogramIdx)
+		{
+			histogramIdx = (unsigned int)histogram.size();
+			histogram.push_back({ (unsigned char)(px.r & 0xf8), (unsigned char)(px.g & 0xf8), (unsigned char)(px.b & 0xf8), snesColor, 0, 0, 0, 0 });
+		}
+
+		HistogramColor& color = histogram[histogramIdx];
+		++color.pxCount;
+		color.accumulatedR += px.r;
+		color.accumulatedG += px.g;
+		color.accumulatedB += px.b;
+	}
+
+	vector<HistogramBucketRange> bucketRanges;
+	const auto ColorsToFind = min(params.maxColors - 1, 255); // we only support 256 colors, minus 1 for the 0th color
+	bucketRanges.reserve(ColorsToFind);
+	HistogramBucketRange& newRange = bucketRanges.push_back();
+	newRange.setBucketRange(histogram.begin(), histogram.end());
+
+	// bucket all of the colors by finding which bucket has the greatest delta across each channel,
+	// and split the bucket about the median color of each bucket
+	// in the end, bucketRanges should have colorsToFind number of buckets, and each should be a unique range
+	// buckets are kept in a heap ordered by their delta, so only the two halves of a split need to be reprioritized
+	IndexedHeap deltaColorHeap(makeDeltaColorCompare(bucketRanges));
+	deltaColorHeap.push(0);
+	while (bucketRanges.size() < ColorsToFind)
+	{
+		unsigned int bucketIdx = deltaColorHeap.top();
+		auto bucketIter = bucketRanges.begin() + bucketIdx;
+
+		// if the bucket with the biggest deltaColor was 0, every bucket is down to a single color, so we're done
+		if (bucketIter->deltaColor == 0)
+			break;
+
+		auto medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
+			[channel = bucketIter->channelDelta, medianColor = bucketIter->midColor](const HistogramColor& color)
+			{ return color.getChannel(channel) <= medianColor; });
+
+		// split the bucket about the median, and shift the current bucketrange down correspondingly
+		HistogramBucketRange& newRange = bucketRanges.push_back();
+		newRange.setBucketRange(medianIter, bucketIter->end);
+		bucketIter->setBucketRange(bucketIter->begin, medianIter);
+		deltaColorHeap.update(bucketIdx);
+		deltaColorHeap.push((unsigned int)bucketRanges.size() - 1);
+	}
+
+	// now that the colors have been bucketed, calculate the avg color of each bucket to determine the image's palette,
+	// and map every 15-bit color in the bucket to it
+	vector<unsigned char> paletteIndices(NumSnesColors, 0);
+	out.palettizedImg.width = out.srcImg.width;
+	out.palettizedImg.height = out.srcImg.height;
+	out.palettizedImg.palette.clear();
+	out.palettizedImg.palette.push_back(0); // add 0 because that's a translucent pixel that should not be used
+	for (const auto& bucket : bucketRanges)
+	{
+		auto paletteIdx = (unsigned char)(out.palettizedImg.palette.size());
+		out.palettizedImg.palette.push_back(bucket.getAverageColor());
+		for (auto colorIter = bucket.begin; colorIter != bucket.end; ++colorIter)
+		{
+			paletteIndices[colorIter->snesColor] = paletteIdx;
+		}
+	}
+
+	// then remap every pixel in a single pass
+	out.palettizedImg.data.resize(out.srcImg.data.size());
+	ISPC_KERNEL(remapToPalette)((uint8_t*)out.srcImg.data.data(), (int)out.srcImg.data.size(), paletteIndices.data(), out.palettizedImg.data.data());
+}
+
+// cumulative moments of the 15-bit color cube, for Wu's quantizer. each table holds, for every (r, g, b) cell, the sum
+// over every color at or below it on all three channels - so the sum over any box of the cube is just 8 lookups
+// the cube is indexed from 1, with a row of zeros along each low edge, so that boxes can start at the very bottom
+struct WuMoments
+{
+	static const int Side = 33;
+
+	static int getIndex(int r, int g, int b) { return (r * Side + g) * Side + b; }
+
+	vector<unsigned int> weight; // pixel count
+	vector<unsigned int> accumulatedR, accumulatedG, accumulatedB; // sum of each 8-bit channel
+	vector<double> accumulatedSquares; // sum of r*r + g*g + b*b
+};
+
+// a box of the color cube, covering (r0, r1] x (g0, g1] x (b0, b1]
+struct WuBox
+{
+	int low[3];
+	int high[3];
+
+	// sum of a moment table over the whole box
+	template<typename T>
+	T getVolume(const vector<T>& moment) const
+	{
+		return moment[WuMoments::getIndex(high[0], high[1], high[2])]
+			- moment[WuMoments::getIndex(high[0], high[1], low[2])]
+			- moment[WuMoments::getIndex(high[0], low[1], high[2])]
+			+ moment[WuMoments::getIndex(high[0], low[1], low[2])]
+			- moment[WuMoments::getIndex(low[0], high[1], high[2])]
+			+ moment[WuMoments::getIndex(low[0], high[1], low[2])]
+			+ moment[WuMoments::getIndex(low[0], low[1], high[2])]
+			- moment[WuMoments::getIndex(low[0], low[1], low[2])];
+	}
+
+	// sum of a moment table over the part of the box at or below position along one channel
+	// (taken relative to the sum up to the box's low edge, so it's also correct when position is the low edge)
+	template<typename T>
+	T getVolumeBelow(const vector<T>& moment, int channel, int position) const
+	{
+		int lowEdge[3] = { low[0], low[1], low[2] };
+		int highEdge[3] = { high[0], high[1], high[2] };
+		lowEdge[channel] = 0;
+		highEdge[channel] = position;
+		return moment[WuMoments::getIndex(highEdge[0], highEdge[1], highEdge[2])]
+			- moment[WuMoments::getIndex(highEdge[0], highEdge[1], lowEdge[2])]
+			- moment[WuMoments::getIndex(highEdge[0], lowEdge[1], highEdge[2])]
+			+ moment[WuMoments::getIndex(highEdge[0], lowEdge[1], lowEdge[2])]
+			- moment[WuMoments::getIndex(lowEdge[0], highEdge[1], highEdge[2])]
+			+ moment[WuMoments::getIndex(lowEdge[0], highEdge[1], lowEdge[2])]
+			+ moment[WuMoments::getIndex(lowEdge[0], lowEdge[1], highEdge[2])]
+			- moment[WuMoments::getIndex(lowEdge[0], lowEdge[1], lowEdge[2])];
+	}
+
+	// the sum of squared distances from every pixel in the box to the box's mean color
+	double getVariance(const WuMoments& moments) const
+	{
+		double r = getVolume(moments.accumulatedR);
+		double g = getVolume(moments.accumulatedG);
+		double b = getVolume(moments.accumulatedB);
+		double weight = getVolume(moments.weight);
+		if (weight == 0)
+			return 0;
+		return getVolume(moments.accumulatedSquares) - (r * r + g * g + b * b) / weight;
+	}
+};
+
+// find where to cut a box along one channel to minimize the variance of the two halves - which is the same as
+// maximizing sum(half)^2 / weight(half) over both halves. returns that maximum, with outCut set to where the lower half
+// ends, or -1 if the box can't be cut along the channel
+double findBestWuCut(const WuBox& box, const WuMoments& moments, int channel, int& outCut)
+{
+	double wholeR = box.getVolume(moments.accumulatedR);
+	double wholeG = box.getVolume(moments.accumulatedG);
+	double wholeB = box.getVolume(moments.accumulatedB);
+	double wholeWeight = box.getVolume(moments.weight);
+	double baseR = box.getVolumeBelow(moments.accumulatedR, channel, box.low[channel]);
+	double baseG = box.getVolumeBelow(moments.accumulatedG, channel, box.low[channel]);
+	double baseB = box.getVolumeBelow(moments.accumulatedB, channel, box.low[channel]);
+	double baseWeight = box.getVolumeBelow(moments.weight, channel, box.low[channel]);
+
+	double best = 0;
+	outCut = -1;
+	for (int cut = box.low[channel] + 1; cut < box.high[channel]; ++cut)
+	{
+		double lowerR = box.getVolumeBelow(moments.accumulatedR, channel, cut) - baseR;
+		double lowerG = box.getVolumeBelow(moments.accumulatedG, channel, cut) - baseG;
+		double lowerB = box.getVolumeBelow(moments.accumulatedB, channel, cut) - baseB;
+		double lowerWeight = box.getVolumeBelow(moments.weight, channel, cut) - baseWeight;
+		double upperWeight = wholeWeight - lowerWeight;
+		if (lowerWeight == 0 || upperWeight == 0)
+			continue;
+
+		double upperR = wholeR - lowerR;
+		double upperG = wholeG - lowerG;
+		double upperB = wholeB - lowerB;
+		double score = (lowerR * lowerR + lowerG * lowerG + lowerB * lowerB) / lowerWeight
+			+ (upperR * upperR + upperG * upperG + upperB * upperB) / upperWeight;
+		if (score > best)
+		{
+			best = score;
+			outCut = cut;
+		}
+	}
+	return best;
+}
+
+void quantizeToSinglePaletteWithWu(const ProcessImageParams& params, ProcessImageStorage& out)
+{
+	// build a histogram of the image over the 15-bit color cube - everything after this only depends on the cube's
+	// size, not the number of pixels
+	WuMoments moments;
+	const size_t NumCells = WuMoments::Side * WuMoments::Side * WuMoments::Side;
+	moments.weight.resize(NumCells, 0);
+	moments.accumulatedR.resize(NumCells, 0);
+	moments.accumulatedG.resize(NumCells, 0);
+	moments.accumulatedB.resize(NumCells, 0);
+	moments.accumulatedSquares.resize(NumCells, 0.0);
+	for (auto px : out.srcImg.data)
+	{
+		int cellIdx = WuMoments::getIndex((px.r >> 3) + 1, (px.g >> 3) + 1, (px.b >> 3) + 1);
+		++moments.weight[cellIdx];
+		moments.accumulatedR[cellIdx] += px.r;
+		moments.accumulatedG[cellIdx] += px.g;
+		moments.accumulatedB[cellIdx] += px.b;
+		moments.accumulatedSquares[cellIdx] += (double)(px.r * px.r + px.g * px.g + px.b * px.b);
+	}
+
+	// then turn it into cumulative moments, by summing along each channel in turn
+	auto accumulateMoments = [](auto& moment)
+	{
+		const int Side = WuMoments::Side;
+		for (int r = 1; r < Side; ++r)
+			for (int g = 1; g < Side; ++g)
+				for (int b = 2; b < Side; ++b)
+					moment[WuMoments::getIndex(r, g, b)] += moment[WuMoments::getIndex(r, g, b - 1)];
+		for (int r = 1; r < Side; ++r)
+			for (int g = 2; g < Side; ++g)
+				for (int b = 1; b < Side; ++b)
+					moment[WuMoments::getIndex(r, g, b)] += moment[WuMoments::getIndex(r, g - 1, b)];
+		for (int r = 2; r < Side; ++r)
+			for (int g = 1; g < Side; ++g)
+				for (int b = 1; b < Side; ++b)
+					moment[WuMoments::getIndex(r, g, b)] += moment[WuMoments::getIndex(r - 1, g, b)];
+	};
+	accumulateMoments(moments.weight);
+	accumulateMoments(moments.accumulatedR);
+	accumulateMoments(moments.accumulatedG);
+	accumulateMoments(moments.accumulatedB);
+	accumulateMoments(moments.accumulatedSquares);
+
+	// start from the whole cube, and keep splitting the box with the most variance, along whichever channel leaves
+	// the least behind. boxes are kept in a heap ordered by their variance, so only the two halves of a cut need to
+	// be reprioritized. a box that can't be cut gets no variance, so it sinks to the bottom
+	const auto ColorsToFind = min(params.maxColors - 1, 255); // we only support 256 colors, minus 1 for the 0th color
+	vector<WuBox> boxes;
+	vector<double> boxVariances;
+	boxes.reserve(ColorsToFind);
+	boxVariances.reserve(ColorsToFind);
+	boxes.push_back({ { 0, 0, 0 }, { WuMoments::Side - 1, WuMoments::Side - 1, WuMoments::Side - 1 } });
+	boxVariances.push_back(boxes.back().getVariance(moments));
+
+	IndexedHeap varianceHeap([&boxVariances](unsigned int a, unsigned int b)
+	{
+		return boxVariances[a] < boxVariances[b] || (boxVariances[a] == boxVariances[b] && a > b);
+	});
+	varianceHeap.push(0);
+	while (boxes.size() < (size_t)ColorsToFind)
+	{
+		unsigned int boxIdx = varianceHeap.top();
+
+		// if the box with the most variance has none, every box is down to a single color, so we're done
+		if (boxVariances[boxIdx] <= 0)
+			break;
+
+		WuBox& box = boxes[boxIdx];
+		int cuts[3];
+		double scores[3];
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			scores[channel] = findBestWuCut(box, moments, channel, cuts[channel]);
+		}
+		int channel = 0;
+		if (scores[1] > scores[channel])
+			channel = 1;
+		if (scores[2] > scores[channel])
+			channel = 2;
+
+		if (cuts[channel] < 0)
+		{
+			boxVariances[boxIdx] = 0;
+			varianceHeap.update(boxIdx);
+			continue;
+		}
+
+		// split the box at the cut, with the upper half becoming a new box
+		WuBox upperBox = box;
+		upperBox.low[channel] = cuts[channel];
+		box.high[channel] = cuts[channel];
+		boxes.push_back(upperBox);
+		boxVariances[boxIdx] = boxes[boxIdx].getVariance(moments);
+		boxVariances.push_back(upperBox.getVariance(moments));
+		varianceHeap.update(boxIdx);
+		varianceHeap.push((unsigned int)boxes.size() - 1);
+	}
+
+	// now that the cube has been split up, the average color of each box makes up the image's palette, and every
+	// 15-bit color in the box maps to it
+	const unsigned int NumSnesColors = 1 << 15;
+	vector<unsigned char> paletteIndices(NumSnesColors, 0);
+	out.palettizedImg.width = out.srcImg.width;
+	out.palettizedImg.height = out.srcImg.height;
+	out.palettizedImg.palette.clear();
+	out.palettizedImg.palette.push_back(0); // add 0 because that's a translucent pixel that should not be used
+	for (const auto& box : boxes)
+	{
+		unsigned int weight = box.getVolume(moments.weight);
+		if (weight == 0)
+			continue;
+
+		auto paletteIdx = (unsigned char)(out.palettizedImg.palette.size());
+		out.palettizedImg.palette.push_back(getSnesColor(
+			(unsigned char)(box.getVolume(moments.accumulatedR) / weight),
+			(unsigned char)(box.getVolume(moments.accumulatedG) / weight),
+			(unsigned char)(box.getVolume(moments.accumulatedB) / weight)));
+		for (int r = box.low[0]; r < box.high[0]; ++r)
+			for (int g = box.low[1]; g < box.high[1]; ++g)
+				for (int b = box.low[2]; b < box.high[2]; ++b)
+					paletteIndices[(b << 10) | (g << 5) | r] = paletteIdx;
+	}
+
+	// then remap every pixel in a single pass
+	out.palettizedImg.data.resize(out.srcImg.data.size());
+	ISPC_KERNEL(remapToPalette)((uint8_t*)out.srcImg.data.data(), (int)out.srcImg.data.size(), paletteIndices.data(), out.palettizedImg.data.data());
+}
+
+// refine a single palette with k-means (Lloyd's algorithm) - map every pixel to its nearest palette color, then move
+// each palette color to the mean of the pixels mapped to it, and repeat. stops after params.refineIterations passes,
+// once a pass would make things worse, or once a pass improves the psnr by too little to be worth another
+void refineSinglePalette(const ProcessImageParams& params, ProcessImageStorage& out)
+{
+	const double MinPsnrGain = 0.01;
+	const unsigned int RowsPerBlock = 16;
+
+	// pixels are mapped in blocks of rows in parallel, with each block gathering the sums for the next palette
+	struct RefineBlock
+	{
+		uint64_t squaredError;
+		eastl::array<unsigned int, 256> pxCount;
+		eastl::array<unsigned int, 256> accumulatedR, accumulatedG, accumulatedB;
+	};
+	const Image& srcImg = out.srcImg;
+	vector<RefineBlock> blocks((srcImg.height + RowsPerBlock - 1) / RowsPerBlock);
+
+	// returns the summed squared error of the mapping
+	auto mapToNearestColors = [&srcImg, &blocks](const PalettizedImage::PaletteTable& palette, vector<unsigned char>& outPaletteIndices)
+	{
+		// compare against palette colors as they'll be displayed
+		eastl::array<unsigned char, 256> paletteR, paletteG, paletteB;
+		for (unsigned int i = 0; i < palette.size(); ++i)
+		{
+			Color color = getColorFromSnesColor(palette[i]);
+			paletteR[i] = color.r;
+			paletteG[i] = color.g;
+			paletteB[i] = color.b;
+		}
+
+		outPaletteIndices.resize(srcImg.data.size());
+		TaskGroup tasks;
+		for (unsigned int blockIdx = 0; blockIdx < blocks.size(); ++blockIdx)
+		{
+			tasks.run([&, blockIdx]
+			{
+				RefineBlock& block = blocks[blockIdx];
+				unsigned int pxFirst = blockIdx * RowsPerBlock * srcImg.width;
+				unsigned int pxLast = min(pxFirst + RowsPerBlock * srcImg.width, (unsigned int)srcImg.data.size());
+				block.squaredError = ISPC_KERNEL(findNearestPaletteColors)((uint8_t*)(srcImg.data.data() + pxFirst), (int)(pxLast - pxFirst),
+					paletteR.data(), paletteG.data(), paletteB.data(), (int)palette.size(), outPaletteIndices.data() + pxFirst);
+
+				block.pxCount.fill(0);
+				block.accumulatedR.fill(0);
+				block.accumulatedG.fill(0);
+				block.accumulatedB.fill(0);
+				for (unsigned int i = pxFirst; i < pxLast; ++i)
+				{
+					unsigned char paletteIdx = outPaletteIndices[i];
+					++block.pxCount[paletteIdx];
+					block.accumulatedR[paletteIdx] += srcImg.data[i].r;
+					block.accumulatedG[paletteIdx] += srcImg.data[i].g;
+					block.accumulatedB[paletteIdx] += srcImg.data[i].b;
+				}
+			});
+		}
+		tasks.wait();
+
+		uint64_t squaredError = 0;
+		for (const auto& block : blocks)
+		{
+			squaredError += block.squaredError;
+		}
+		return squaredError;
+	};
+
+	// moves each color to the mean of the pixels that were last mapped to it. colors nothing was mapped to stay put
+	auto moveToMeans = [&blocks](PalettizedImage::PaletteTable& palette)
+	{
+		for (unsigned int i = 1; i < palette.size(); ++i)
+		{
+			unsigned int pxCount = 0, accumulatedR = 0, accumulatedG = 0, accumulatedB = 0;
+			for (const auto& block : blocks)
+			{
+				pxCount += block.pxCount[i];
+				accumulatedR += block.accumulatedR[i];
+				accumulatedG += block.accumulatedG[i];
+				accumulatedB += block.accumulatedB[i];
+			}
+			if (pxCount == 0)
+				continue;
+
+			// round to the nearest 15-bit color, rather than truncating
+			auto roundChannel = [pxCount](unsigned int accumulated)
+			{
+				return (unsigned char)min(255u, (accumulated + pxCount / 2) / pxCount + 4);
+			};
+			palette[i] = getSnesColor(roundChannel(accumulatedR), roundChannel(accumulatedG), roundChannel(accumulatedB));
+		}
+	};
+
+	// the quantizers map every pixel by the bucket it ended up in, which isn't necessarily its nearest color, so
+	// just remapping them is already an improvement
+	PalettizedImage& palettizedImg = out.palettizedImg;
+	uint64_t squaredError = mapToNearestColors(palettizedImg.palette, palettizedImg.data);
+
+	PalettizedImage::PaletteTable candidatePalette;
+	vector<unsigned char> candidatePaletteIndices;
+	for (int i = 0; i < params.refineIterations && squaredError > 0; ++i)
+	{
+		candidatePalette = palettizedImg.palette;
+		moveToMeans(candidatePalette);
+		uint64_t candidateSquaredError = mapToNearestColors(candidatePalette, candidatePaletteIndices);
+		if (candidateSquaredError >= squaredError)
+			break;
+
+		double psnrGain = 10.0 * log10((double)squaredError / (double)candidateSquaredError);
+		palettizedImg.palette = candidatePalette;
+		palettizedImg.data.swap(candidatePaletteIndices);
+		squaredError = candidateSquaredError;
+		if (psnrGain < MinPsnrGain)
+			break;
+	}
+}
+
+// 4bpp (or 2bpp) - every 8x8 tile picks one of up to params.maxPalettes 16c (or 4c) palettes. this is k-means over tiles, with a palette
+// as each cluster's center: tiles start out grouped by their average color, then each group has a palette picked for
+// its px (by params.quantizer, same as a single palette), and every tile moves to whichever palette represents it best.
+// that repeats until no tile moves. the palettes are laid out the way they'd be loaded into cgram, 16 (or 4) entries
+// each (with the first of each being transparent), and every px holds its full cgram index
+void quantizeToTilePalettes(const ProcessImageParams& params, ProcessImageStorage& out)
+{
+	const unsigned int TileSize = 8;
+	const unsigned int TilePxCount = TileSize * TileSize;
+	const unsigned int MaxColorsPerPalette = 16;
+	const unsigned int MaxPalettes = 8;
+	const unsigned int BitsPerPixel = params.tileBitsPerPixel == 2 ? 2 : 4;
+	const unsigned int ColorsPerPalette = 1 << BitsPerPixel;
+	const int MaxFitPasses = 8;
+	const unsigned int TilesPerBlock = 32;
+
+	const Image& srcImg = out.srcImg;
+	const unsigned int TilesWide = (srcImg.width + TileSize - 1) / TileSize;
+	const unsigned int TileCount = TilesWide * ((srcImg.height + TileSize - 1) / TileSize);
+
+	// gather every tile's px together, so a tile can be handed to the kernels as is. tiles that hang over the right or
+	// bottom edge are padded out by repeating the last px of the image on that side, so the padding doesn't pull their
+	// palette towards colors the image doesn't have
+	vector<Color> tilePxs(TileCount * TilePxCount);
+	for (unsigned int tileIdx = 0; tileIdx < TileCount; ++tileIdx)
+	{
+		unsigned int tileX = (tileIdx % TilesWide) * TileSize;
+		unsigned int tileY = (tileIdx / TilesWide) * TileSize;
+		unsigned int copyCount = min(TileSize, srcImg.width - tileX);
+		for (unsigned int row = 0; row < TileSize; ++row)
+		{
+			const Color* srcRow = &srcImg.data[min(tileY + row, srcImg.height - 1) * srcImg.width + tileX];
+			Color* tileRow = &tilePxs[tileIdx * TilePxCount + row * TileSize];
+			memcpy(tileRow, srcRow, copyCount * sizeof(Color));
+			eastl::fill(tileRow + copyCount, tileRow + TileSize, srcRow[copyCount - 1]);
+		}
 	}
 
-	void applyPaletteIndex(eastl::vector<unsigned char>& data, unsigned char paletteIdx)
+	// group the tiles to start with by running median cut over an image of their average colors - the palette it picks
+	// for that image is thrown away, and what's left is which of the averages it grouped together
+	ProcessImageParams fitParams = params;
+	vector<unsigned char> tilePaletteIndices(TileCount);
+	unsigned int paletteCount;
 	{
-		for (auto pxIter = begin; pxIter != end; ++pxIter)
+		ProcessImageStorage averageStorage;
+		averageStorage.srcImg.width = TileCount;
+		averageStorage.srcImg.height = 1;
+		averageStorage.srcImg.data.resize(TileCount);
+		for (unsigned int tileIdx = 0; tileIdx < TileCount; ++tileIdx)
+		{
+			unsigned int accumulatedR = 0, accumulatedG = 0, accumulatedB = 0;
+			for (unsigned int i = tileIdx * TilePxCount; i < (tileIdx + 1) * TilePxCount; ++i)
+			{
+				accumulatedR += tilePxs[i].r;
+				accumulatedG += tilePxs[i].g;
+				accumulatedB += tilePxs[i].b;
+			}
+			averageStorage.srcImg.data[tileIdx] = { (unsigned char)(accumulatedR / TilePxCount), (unsigned char)(accumulatedG / TilePxCount), (unsigned char)(accumulatedB / TilePxCount) };
+		}
+		fitParams.maxColors = min(max(params.maxPalettes, 1), (int)MaxPalettes) + 1;
+		quantizeToSinglePalette(fitParams, averageStorage);
+		paletteCount = (unsigned int)averageStorage.palettizedImg.palette.size() - 1;
+		for (unsigned int tileIdx = 0; tileIdx < TileCount; ++tileIdx)
 		{
-			data[get<unsigned int&>(*pxIter)] = paletteIdx;
+			tilePaletteIndices[tileIdx] = averageStorage.palettizedImg.data[tileIdx] - 1;
 		}
 	}
-};
 
-void quantizeToSinglePalette(const ProcessImageParams& params, ProcessImageStorage& out)
-{
-	// copy the src image data into an array that will let us track how it gets sorted and reordered
-	IndexedImageData indexedImageData;
-	indexedImageData.reserve(out.srcImg.data.size());
-	
-	unsigned int idx = 0;
-	for (auto px : out.srcImg.data)
+	// palette colors are kept as they'll be displayed, a channel per array, for the kernels
+	struct TilePalette
 	{
-		indexedImageData.push_back(px.r, px.g, px.b, idx);
-		++idx;
-	}
+		PalettizedImage::PaletteTable snesColors;
+		eastl::array<unsigned char, MaxColorsPerPalette> r, g, b;
+	};
+	eastl::array<TilePalette, MaxPalettes> palettes;
+	vector<unsigned char> tileColorIndices(TileCount * TilePxCount);
+	fitParams.maxColors = ColorsPerPalette;
+	fitParams.maxHdmaChannels = 0;
+	for (int pass = 0; pass < MaxFitPasses; ++pass)
+	{
+		// pick a palette for the px of every group of tiles. a palette that no tile picked last time is left as it was,
+		// so it can still win some tiles back
+		TaskGroup fitTasks;
+		for (unsigned int paletteIdx = 0; paletteIdx < paletteCount; ++paletteIdx)
+		{
+			fitTasks.run([&, paletteIdx]
+			{
+				ProcessImageStorage fitStorage;
+				for (unsigned int tileIdx = 0; tileIdx < TileCount; ++tileIdx)
+				{
+					if (tilePaletteIndices[tileIdx] == paletteIdx)
+						fitStorage.srcImg.data.insert(fitStorage.srcImg.data.end(), &tilePxs[tileIdx * TilePxCount], &tilePxs[(tileIdx + 1) * TilePxCount]);
+				}
+				if (fitStorage.srcImg.data.empty())
+					return;
 
-	vector<IndexedImageBucketRange> bucketRanges;
-	const auto ColorsToFind = min(params.maxColors - 1, 255); // we only support 256 colors, minus 1 for the 0th color
-	bucketRanges.reserve(ColorsToFind);
-	IndexedImageBucketRange& newRange = bucketRanges.push_back();
-	newRange.setBucketRange(indexedImageData.begin(), indexedImageData.end(), out.srcImg.width);
+				fitStorage.srcImg.width = TileSize;
+				fitStorage.srcImg.height = (unsigned int)fitStorage.srcImg.data.size() / TileSize;
+				if (fitParams.quantizer == Quantizer::Wu)
+					quantizeToSinglePaletteWithWu(fitParams, fitStorage);
+				else
+					quantizeToSinglePalette(fitParams, fitStorage);
+				if (fitParams.refineIterations > 0)
+					refineSinglePalette(fitParams, fitStorage);
 
-	// bucket all of the colors by finding which bucket has the greatest delta across each channel,
-	// and split the bucket about the median color of each bucket
-	// in the end, bucketRanges should have colorsToFind number of buckets, and each should be a unique range
-	while (bucketRanges.size() < ColorsToFind)
-	{
-		auto bucketIter = eastl::max_element(bucketRanges.begin(), bucketRanges.end(),
-			[](const IndexedImageBucketRange& a, const IndexedImageBucketRange& b)
-			{ return a.deltaColor < b.deltaColor; });
+				TilePalette& palette = palettes[paletteIdx];
+				palette.snesColors = fitStorage.palettizedImg.palette;
+				for (unsigned int i = 0; i < palette.snesColors.size(); ++i)
+				{
+					Color color = getColorFromSnesColor(palette.snesColors[i]);
+					palette.r[i] = color.r;
+					palette.g[i] = color.g;
+					palette.b[i] = color.b;
+				}
+			});
+		}
+		fitTasks.wait();
 
-		IndexedImageDataIterator medianIter;
-		switch (bucketIter->channelDelta)
+		// then move every tile to the palette that maps its px with the least error, a block of tiles at a time
+		std::atomic<bool> isAnyTileMoved{ false };
+		TaskGroup assignTasks;
+		for (unsigned int tileFirst = 0; tileFirst < TileCount; tileFirst += TilesPerBlock)
 		{
-		case 0:
-			// partition around red
-			medianIter = eastl::partition(bucketIter->begin, bucketIter->end, 
-				[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a) 
-				{ return get<0>(a) <= medianColor; });
-			break;
-		case 1:
-			// partition around green
-			medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-				[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a)
-				{ return get<1>(a) <= medianColor; });
-			break;
-		case 2:
-			// partition around blue
-			medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-				[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a)
-				{ return get<2>(a) <= medianColor; });
+			assignTasks.run([&, tileFirst]
+			{
+				eastl::array<unsigned char, TilePxCount> colorIndices;
+				unsigned int tileLast = min(tileFirst + TilesPerBlock, TileCount);
+				for (unsigned int tileIdx = tileFirst; tileIdx < tileLast; ++tileIdx)
+				{
+					uint64_t nearestError = ~0ull;
+					unsigned char nearestPaletteIdx = tilePaletteIndices[tileIdx];
+					for (unsigned int paletteIdx = 0; paletteIdx < paletteCount; ++paletteIdx)
+					{
+						const TilePalette& palette = palettes[paletteIdx];
+						uint64_t error = ISPC_KERNEL(findNearestPaletteColors)((uint8_t*)&tilePxs[tileIdx * TilePxCount], (int)TilePxCount,
+							palette.r.data(), palette.g.data(), palette.b.data(), (int)palette.snesColors.size(), colorIndices.data());
+						if (error < nearestError)
+						{
+							nearestError = error;
+							nearestPaletteIdx = (unsigned char)paletteIdx;
+							memcpy(&tileColorIndices[tileIdx * TilePxCount], colorIndices.data(), TilePxCount);
+						}
+					}
+
+					if (nearestPaletteIdx != tilePaletteIndices[tileIdx])
+					{
+						tilePaletteIndices[tileIdx] = nearestPaletteIdx;
+						isAnyTileMoved = true;
+					}
+				}
+			});
+		}
+		assignTasks.wait();
+
+		if (!isAnyTileMoved)
 			break;
-		};
+	}
 
-		// split the bucket about the median, and shift the current bucketrange down correspondingly
-		IndexedImageBucketRange& newRange = bucketRanges.push_back();
-		newRange.setBucketRange(medianIter, bucketIter->end, out.srcImg.width);
-		bucketIter->setBucketRange(bucketIter->begin, medianIter, out.srcImg.width);
+	// lay the palettes out back to back, and write every px out as an index into the whole lot
+	PalettizedImage& palettizedImg = out.palettizedImg;
+	palettizedImg.width = srcImg.width;
+	palettizedImg.height = srcImg.height;
+	palettizedImg.bitsPerPixel = BitsPerPixel;
+	palettizedImg.palette.clear();
+	for (unsigned int paletteIdx = 0; paletteIdx < paletteCount; ++paletteIdx)
+	{
+		const PalettizedImage::PaletteTable& snesColors = palettes[paletteIdx].snesColors;
+		palettizedImg.palette.insert(palettizedImg.palette.end(), snesColors.begin(), snesColors.end());
+		palettizedImg.palette.resize((paletteIdx + 1) * ColorsPerPalette, 0);
 	}
 
-	// now that the colors have been bucketed, calculate the avg color of each bucket to determine the image's palette 
-	out.palettizedImg.width = out.srcImg.width;
-	out.palettizedImg.height = out.srcImg.height;
-	out.palettizedImg.data.resize(out.srcImg.data.size());
-	out.palettizedImg.palette.clear();
-	out.palettizedImg.palette.push_back(0); // add 0 because that's a translucent pixel that should not be used
-	for (auto bucket : bucketRanges)
+	// only the px of a partial tile that are actually in the image get written out, the padding is dropped
+	palettizedImg.data.resize(srcImg.data.size());
+	for (unsigned int tileIdx = 0; tileIdx < TileCount; ++tileIdx)
 	{
-		auto paletteIdx = (unsigned char)(out.palettizedImg.palette.size());
-		out.palettizedImg.palette.push_back(bucket.getAverageColor());
-		bucket.applyPaletteIndex(out.palettizedImg.data, paletteIdx);
+		unsigned int tileX = (tileIdx % TilesWide) * TileSize;
+		unsigned int tileY = (tileIdx / TilesWide) * TileSize;
+		unsigned int colCount = min(TileSize, srcImg.width - tileX);
+		unsigned int rowCount = min(TileSize, srcImg.height - tileY);
+		unsigned char paletteOffset = (unsigned char)(tilePaletteIndices[tileIdx] * ColorsPerPalette);
+		for (unsigned int row = 0; row < rowCount; ++row)
+		{
+			for (unsigned int col = 0; col < colCount; ++col)
+			{
+				palettizedImg.data[(tileY + row) * srcImg.width + tileX + col] = paletteOffset + tileColorIndices[tileIdx * TilePxCount + row * TileSize + col];
+			}
+		}
 	}
 }
 
@@ -311,10 +1169,13 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 	indexedImageData.reserve(out.srcImg.data.size());
 
 	unsigned int idx = 0;
-	for (auto px : out.srcImg.data)
+	for (unsigned int y = 0; y < out.srcImg.height; ++y)
 	{
-		indexedImageData.push_back(px.r, px.g, px.b, idx);
-		++idx;
+		for (unsigned int x = 0; x < out.srcImg.width; ++x, ++idx)
+		{
+			const Color& px = out.srcImg.data[idx];
+			indexedImageData.push_back(px.r, px.g, px.b, idx, (unsigned char)y);
+		}
 	}
 
 	const auto ParamMaxHdmaChannels = params.maxHdmaChannels;
@@ -326,120 +1187,196 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 	fixed_vector<IndexedImageBucketRange, MaxBuckets, false> bucketRanges; // max possible buckets is 255 colors + 224 * 8 scanlines of hdma data
 	const auto ColorsToFind = min(params.maxColors, MaxColors)-1; // we only support 256 colors, minus 1 for the 0th color
 	IndexedImageBucketRange& newRange = bucketRanges.push_back();
-	newRange.setBucketRange(indexedImageData.begin(), indexedImageData.end(), out.srcImg.width);
+	newRange.setBucketRange(indexedImageData.begin(), indexedImageData.end());
 
 	fixed_vector<unsigned int, MaxColors, false> paletteBucketRangeIndices;
 	fixed_vector<unsigned int, MaxHdmaBuckets, false> hdmaBucketRangeIndices;
 	
 	// first element is what bucket got evicted; second element is what bucket is populating the eviction
 	fixed_vector<pair<unsigned int, unsigned int>, (MaxHeight-1) * MaxHdmaChannels, false> hdmaPopulationList; 
-	
-	while (paletteBucketRangeIndices.size() < ColorsToFind || hdmaBucketRangeIndices.size() < hdmaBucketRangeIndices.capacity())
+
+	// buckets are kept in a heap by how much their colors vary, so that picking the next bucket to split on color doesn't
+	// need to look at every bucket, and only the two halves of a split need to be reprioritized
+	IndexedHeap deltaColorHeap(makeDeltaColorCompare(bucketRanges));
+	deltaColorHeap.push(0);
+
+	// the schedule sweeps the buckets by descending scanlineFirst, pairing each with the bucket of highest scanlineLast
+	// that ends before it. both orders are kept sorted as buckets split, rather than being rebuilt and sorted every
+	// time the schedule is generated. ties go to the earliest bucket, so the schedule doesn't depend on sort stability
+	fixed_vector<unsigned int, MaxBuckets, false> bucketsByScanlineFirst;
+	fixed_vector<unsigned int, MaxBuckets, false> bucketsByScanlineLast;
+	auto scanlineFirstOrder = [&bucketRanges](unsigned int a, unsigned int b)
 	{
-		// reset the list of baseBucketRangeIndices and hdmaBucketRangeIndices
-		paletteBucketRangeIndices.clear();
-		hdmaBucketRangeIndices.clear();
-		hdmaPopulationList.clear();
-		if (bucketRanges.size() >= ColorsToFind)
-		{
-			// with current set of bucketRanges, generate current hdma table
+		return bucketRanges[a].scanlineFirst > bucketRanges[b].scanlineFirst || (bucketRanges[a].scanlineFirst == bucketRanges[b].scanlineFirst && a < b);
+	};
+	auto scanlineLastOrder = [&bucketRanges](unsigned int a, unsigned int b)
+	{
+		return bucketRanges[a].scanlineLast < bucketRanges[b].scanlineLast || (bucketRanges[a].scanlineLast == bucketRanges[b].scanlineLast && a > b);
+	};
+	auto scheduleBucket = [&](unsigned int bucketIdx)
+	{
+		bucketsByScanlineFirst.insert(eastl::upper_bound(bucketsByScanlineFirst.begin(), bucketsByScanlineFirst.end(), bucketIdx, scanlineFirstOrder), bucketIdx);
+		bucketsByScanlineLast.insert(eastl::upper_bound(bucketsByScanlineLast.begin(), bucketsByScanlineLast.end(), bucketIdx, scanlineLastOrder), bucketIdx);
+	};
+	auto unscheduleBucket = [&](unsigned int bucketIdx)
+	{
+		// the bucket's scanlines have already changed by now, so it can't be searched for by them
+		bucketsByScanlineFirst.erase(eastl::find(bucketsByScanlineFirst.begin(), bucketsByScanlineFirst.end(), bucketIdx));
+		bucketsByScanlineLast.erase(eastl::find(bucketsByScanlineLast.begin(), bucketsByScanlineLast.end(), bucketIdx));
+	};
+	scheduleBucket(0);
+
+	// with current set of bucketRanges, generate current hdma table - a list of buckets to be used for the base palette,
+	// and a list of buckets to be used as replacements via hdma
+	// the state of the sweep whenever it reaches a new scanlineFirst (plus the state it finished in), so that after a
+	// split, the sweep can pick up from the last checkpoint the split couldn't have affected instead of starting over
+	struct HdmaScheduleCheckpoint
+	{
+		// position in bucketsByScanlineFirst
+		unsigned short bucketCount;
+		unsigned short paletteCount;
+		unsigned short hdmaCount;
+		// taken off the back of bucketsByScanlineLast, either to be evicted or because they end too late to be
+		unsigned short unavailableHdmaCount;
+		unsigned char minScanline;
+		unsigned char actionsOnScanline;
+	};
+	fixed_vector<HdmaScheduleCheckpoint, MaxHeight + 2, false> hdmaScheduleCheckpoints;
+	hdmaScheduleCheckpoints.push_back({ 0, 0, 0, 0, MaxHeight, 0 });
+	size_t hdmaScheduleResumeCheckpoint = 0;
 
-			// generate a list of buckets to be used for the base palette, and a list of buckets to be used as replacements via hdma
-			fixed_vector<unsigned int, MaxBuckets, false> baseBucketRangeIndices(bucketRanges.size());
-			eastl::iota(baseBucketRangeIndices.begin(), baseBucketRangeIndices.end(), 0);
-			fixed_vector<unsigned int, MaxBuckets, false> availableHdmaIndices = baseBucketRangeIndices;
+	auto generateHdmaSchedule = [&]()
+	{
+		const HdmaScheduleCheckpoint resumeCheckpoint = hdmaScheduleCheckpoints[hdmaScheduleResumeCheckpoint];
+		hdmaScheduleCheckpoints.resize(hdmaScheduleResumeCheckpoint);
+		paletteBucketRangeIndices.resize(resumeCheckpoint.paletteCount);
+		hdmaBucketRangeIndices.resize(resumeCheckpoint.hdmaCount);
+		hdmaPopulationList.resize(resumeCheckpoint.hdmaCount);
 
-			eastl::sort(baseBucketRangeIndices.begin(), baseBucketRangeIndices.end(),
-				[&bucketRanges](unsigned int a, unsigned int b)
-				{ return bucketRanges[a].scanlineFirst > bucketRanges[b].scanlineFirst; });
-			eastl::sort(availableHdmaIndices.begin(), availableHdmaIndices.end(),
-				[&bucketRanges](unsigned int a, unsigned int b)
-				{ return bucketRanges[a].scanlineLast < bucketRanges[b].scanlineLast; });
+		// buckets are only ever taken off the back of the scanlineLast order, so the ones still available for hdma
+		// are always the first availableHdmaCount of them
+		size_t availableHdmaCount = bucketsByScanlineLast.size() - resumeCheckpoint.unavailableHdmaCount;
 
-			
-			// advance through the list of bucket ranges, finding candidates that can evict a color
-			unsigned char minScanline = MaxHeight;
-			unsigned char actionsOnScanline = 0;
+		// advance through the list of bucket ranges, finding candidates that can evict a color
+		unsigned char minScanline = resumeCheckpoint.minScanline;
+		unsigned char actionsOnScanline = resumeCheckpoint.actionsOnScanline;
+
+		auto addCheckpoint = [&](size_t bucketCount)
+		{
+			hdmaScheduleCheckpoints.push_back({ (unsigned short)bucketCount, (unsigned short)paletteBucketRangeIndices.size(), (unsigned short)hdmaBucketRangeIndices.size(),
+				(unsigned short)(bucketsByScanlineLast.size() - availableHdmaCount), minScanline, actionsOnScanline });
+		};
+		addCheckpoint(resumeCheckpoint.bucketCount);
 
-			for (auto bucketIndex : baseBucketRangeIndices)
+		for (size_t bucketCount = resumeCheckpoint.bucketCount; bucketCount < bucketsByScanlineFirst.size(); ++bucketCount)
+		{
+			unsigned int bucketIndex = bucketsByScanlineFirst[bucketCount];
+			// if we are about to apply a whole new minScanline, then move it and reset the actionsOnScanline back to zero
+			if (bucketRanges[bucketIndex].scanlineFirst < minScanline)
 			{
-				// if we are about to apply a whole new minScanline, then move it and reset the actionsOnScanline back to zero
-				if (bucketRanges[bucketIndex].scanlineFirst < minScanline)
-				{
-					minScanline = bucketRanges[bucketIndex].scanlineFirst;
-					actionsOnScanline = 0;
-				}
+				if (bucketCount > resumeCheckpoint.bucketCount)
+					addCheckpoint(bucketCount);
+				minScanline = bucketRanges[bucketIndex].scanlineFirst;
+				actionsOnScanline = 0;
+			}
 
-				// any availableHdmaIndices that are not fit for hdma candidates need to be removed
-				while (availableHdmaIndices.size() > 0 && bucketRanges[availableHdmaIndices.back()].scanlineLast >= minScanline)
-				{
-					availableHdmaIndices.pop_back();
-				}
+			// any available buckets that are not fit for hdma candidates need to be removed
+			while (availableHdmaCount > 0 && bucketRanges[bucketsByScanlineLast[availableHdmaCount - 1]].scanlineLast >= minScanline)
+			{
+				--availableHdmaCount;
+			}
 
-				// we have an hdma candidate if the list of availableHdmaIndices still has a survivor, so track this bucket as hdma-able
-				if (availableHdmaIndices.size() > 0 && hdmaBucketRangeIndices.size() < hdmaBucketRangeIndices.capacity())
-				{
-					auto hdmaBucketIndex = availableHdmaIndices.back();
-					hdmaBucketRangeIndices.push_back(bucketIndex);
-					hdmaPopulationList.push_back(make_pair(hdmaBucketIndex, bucketIndex));
-					availableHdmaIndices.pop_back();
-				}
-				else // otherwise, this bucket has to go into the base palette
-				{
-					paletteBucketRangeIndices.push_back(bucketIndex);
-				}
-			
-				// mark the number of actions performed on our current minScanline
-				// if we hit the limit, then move the minScanline back one
-				++actionsOnScanline;
-				if (actionsOnScanline == ParamMaxHdmaChannels && minScanline > 0)
-				{
-					actionsOnScanline = 0;
-					--minScanline;
-				}
+			// we have an hdma candidate if an available bucket still survives, so track this bucket as hdma-able
+			if (availableHdmaCount > 0 && hdmaBucketRangeIndices.size() < hdmaBucketRangeIndices.capacity())
+			{
+				--availableHdmaCount;
+				auto hdmaBucketIndex = bucketsByScanlineLast[availableHdmaCount];
+				hdmaBucketRangeIndices.push_back(bucketIndex);
+				hdmaPopulationList.push_back(make_pair(hdmaBucketIndex, bucketIndex));
+			}
+			else // otherwise, this bucket has to go into the base palette
+			{
+				paletteBucketRangeIndices.push_back(bucketIndex);
+			}
+
+			// mark the number of actions performed on our current minScanline
+			// if we hit the limit, then move the minScanline back one
+			++actionsOnScanline;
+			if (actionsOnScanline == ParamMaxHdmaChannels && minScanline > 0)
+			{
+				actionsOnScanline = 0;
+				--minScanline;
 			}
 		}
+		addCheckpoint(bucketsByScanlineFirst.size());
+		hdmaScheduleResumeCheckpoint = hdmaScheduleCheckpoints.size() - 1;
+	};
+
+	// both halves of a split lie within the scanlines of the bucket before it was split, so everything the sweep did
+	// while it only visited buckets starting after splitScanlineLast, and only took buckets ending after it, went
+	// exactly the same way as it would now
+	auto invalidateHdmaSchedule = [&](unsigned char splitScanlineLast)
+	{
+		size_t unaffectedBucketCount = eastl::upper_bound(bucketsByScanlineFirst.begin(), bucketsByScanlineFirst.end(), splitScanlineLast,
+			[&bucketRanges](unsigned char scanline, unsigned int bucketIdx) { return bucketRanges[bucketIdx].scanlineFirst <= scanline; })
+			- bucketsByScanlineFirst.begin();
+		size_t unaffectedHdmaCount = bucketsByScanlineLast.end() - eastl::upper_bound(bucketsByScanlineLast.begin(), bucketsByScanlineLast.end(), splitScanlineLast,
+			[&bucketRanges](unsigned char scanline, unsigned int bucketIdx) { return scanline < bucketRanges[bucketIdx].scanlineLast; });
+
+		// checkpoints only ever move further through both orders, so the first affected one can be binary searched for
+		auto checkpointsEnd = hdmaScheduleCheckpoints.begin() + hdmaScheduleResumeCheckpoint + 1;
+		auto firstAffectedCheckpoint = eastl::upper_bound(hdmaScheduleCheckpoints.begin(), checkpointsEnd, unaffectedBucketCount,
+			[](size_t bucketCount, const HdmaScheduleCheckpoint& checkpoint) { return bucketCount < checkpoint.bucketCount; });
+		firstAffectedCheckpoint = eastl::upper_bound(hdmaScheduleCheckpoints.begin(), firstAffectedCheckpoint, unaffectedHdmaCount,
+			[](size_t hdmaCount, const HdmaScheduleCheckpoint& checkpoint) { return hdmaCount < checkpoint.unavailableHdmaCount; });
+		hdmaScheduleResumeCheckpoint = (firstAffectedCheckpoint - hdmaScheduleCheckpoints.begin()) - 1;
+	};
+
+	auto onBucketSplit = [&](unsigned int bucketIdx, unsigned char splitScanlineLast)
+	{
+		unsigned int newBucketIdx = (unsigned int)bucketRanges.size() - 1;
+		deltaColorHeap.update(bucketIdx);
+		deltaColorHeap.push(newBucketIdx);
+		unscheduleBucket(bucketIdx);
+		scheduleBucket(bucketIdx);
+		scheduleBucket(newBucketIdx);
+		invalidateHdmaSchedule(splitScanlineLast);
+	};
+	
+	TraceScope bucketTraceScope("hdmaBucketLoop", params.inFilePath);
+	bool isHdmaScheduleCurrent = false;
+	while (paletteBucketRangeIndices.size() < ColorsToFind || hdmaBucketRangeIndices.size() < hdmaBucketRangeIndices.capacity())
+	{
+		// there's no point in scheduling until there are enough buckets to fill the palette
+		isHdmaScheduleCurrent = bucketRanges.size() >= ColorsToFind;
+		if (isHdmaScheduleCurrent)
+			generateHdmaSchedule();
 
 		// we can still split on colors
 		if (paletteBucketRangeIndices.size() < ColorsToFind)
 		{
 			// first bucket all of the colors by finding which bucket has the greatest delta across each channel,
 			// and split the bucket about the median color of each bucket
-			auto bucketIter = eastl::max_element(bucketRanges.begin(), bucketRanges.end(),
-				[](const IndexedImageBucketRange& a, const IndexedImageBucketRange& b)
-				{ return a.deltaColor < b.deltaColor; });
+			unsigned int bucketIdx = deltaColorHeap.top();
+			auto bucketIter = bucketRanges.begin() + bucketIdx;
 
 			// if the bucket with the biggest deltaColor was 0, we must have perfectly bucketed everything, so we're done
 			if (bucketIter->deltaColor == 0)
 				break;
 
-			IndexedImageDataIterator medianIter;
-			switch (bucketIter->channelDelta)
-			{
-			case 0:
-				// partition around red
-				medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-					[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a)
-					{ return get<0>(a) <= medianColor; });
-				break;
-			case 1:
-				// partition around green
-				medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-					[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a)
-					{ return get<1>(a) <= medianColor; });
-				break;
-			case 2:
-				// partition around blue
-				medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-					[medianColor = bucketIter->midColor](IndexedImageData::const_reference_tuple a)
-					{ return get<2>(a) <= medianColor; });
-				break;
-			};
+			IndexedImageBucketStats lowerStats;
+			IndexedImageBucketStats upperStats;
+			auto medianIter = bucketIter->partition(
+				[channel = bucketIter->channelDelta, medianColor = bucketIter->midColor](unsigned char r, unsigned char g, unsigned char b, unsigned char)
+				{ return (channel == 0 ? r : (channel == 1 ? g : b)) <= medianColor; },
+				lowerStats, upperStats);
 
 			// split the bucket about the median, and shift the current bucketrange down correspondingly
+			unsigned char splitScanlineLast = bucketIter->scanlineLast;
 			IndexedImageBucketRange& newRange = bucketRanges.push_back();
-			newRange.setBucketRange(medianIter, bucketIter->end, out.srcImg.width);
-			bucketIter->setBucketRange(bucketIter->begin, medianIter, out.srcImg.width);
+			newRange.setBucketRange(medianIter, bucketIter->end, upperStats);
+			bucketIter->setBucketRange(bucketIter->begin, medianIter, lowerStats);
+			onBucketSplit(bucketIdx, splitScanlineLast);
 		}
 		// if we can still fill up the hdma list, split on scanline gap
 		else if (hdmaBucketRangeIndices.size() < hdmaBucketRangeIndices.capacity())
@@ -490,72 +1427,82 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 				}
 			}
 
-			auto bucketIter = eastl::find_if(bucketRanges.begin(), bucketRanges.end(),
-				[&bucketRanges, &nextAvailableHdmaScanline, &prevAvailableHdmaScanline]
-				(const IndexedImageBucketRange& bucket)
-				{
-					// find what scanline this bucket could be loaded in on, first
-					auto scanlineGapEnd = bucket.scanlineGapEnd;
-					auto scanlineGapStart = nextAvailableHdmaScanline[scanlineGapEnd - bucket.scanlineGapSize];
-
-					if (scanlineGapStart >= scanlineGapEnd)
-						return false;
-					
-					// find a bucket that we could split against
-					auto evictionCandidate = eastl::find_if(bucketRanges.begin(), bucketRanges.end(),
-						[scanlineGapStart, scanlineGapEnd, &nextAvailableHdmaScanline, &prevAvailableHdmaScanline](const IndexedImageBucketRange& hdmaCandidate)
-						{ 
-							// we already would have been evicting/populating between this pair
-							//if (hdmaCandidate.scanlineFirst > bucket.scanlineLast || hdmaCandidate.scanlineLast < bucket.scanlineFirst)
-							//	return false;
-
-							// check if hdmaCandidate's final scanline is before our first possible scanline
-							// this only takes into account bucket pairs that are like so:
-							// -|||-------|||----- <- Bucket - split this along the scanline
-							// ------|||---------- <- hdmaCandidate?
-							// on next iteration of building hdma table, we should be able to unload hdmaCandidate,
-							// (or maybe some other bucket will prove to be viable - but we know that ONE is)
-							// and load in the lower-split of bucket
-							if (nextAvailableHdmaScanline[hdmaCandidate.scanlineLast] >= scanlineGapEnd)
-								return false;
-
-							if (prevAvailableHdmaScanline[hdmaCandidate.scanlineFirst] <= scanlineGapStart)
-								return false;
-
-							// check if hdmaCandidate's first non-gap sequence (that we can see) is within 
-							// bucket's gap. this takes into account bucket pairs like so:
-							// -|||-------|||----- <- Bucket 
-							// ------|||------|||- <- hdmaCandidate?
-							// on next iteration of building hdma table, we probably won't match a candidate,
-							// but we probably will have things set up so that maybe hdmaCandidate will split
-							// about the split Bucket when we're looking for buckets to split
-							if (nextAvailableHdmaScanline[hdmaCandidate.scanlineGapEnd - hdmaCandidate.scanlineGapSize] >= scanlineGapEnd)
-								return false;
-
-							if (prevAvailableHdmaScanline[hdmaCandidate.scanlineFirst] <= scanlineGapStart)
-								return false;
-
-							return true;
-						});
-					
-					return evictionCandidate != bucketRanges.end();
-			});
+			// a bucket can be evicted to make room for the lower half of a split if it ends before the gap can be loaded
+			// into, and starts after the gap opens, which only depends on two scanlines per bucket. so rather than
+			// testing every bucket against every gap, index the buckets by the first of those scanlines, keeping the
+			// latest second scanline of any bucket at or before each one
+			eastl::array<int, MaxHeight + 1> latestEvictionStartByEnd;
+			latestEvictionStartByEnd.fill(-1);
+			for (const IndexedImageBucketRange& hdmaCandidate : bucketRanges)
+			{
+				// check if hdmaCandidate's final scanline is before our first possible scanline
+				// this only takes into account bucket pairs that are like so:
+				// -|||-------|||----- <- Bucket - split this along the scanline
+				// ------|||---------- <- hdmaCandidate?
+				// on next iteration of building hdma table, we should be able to unload hdmaCandidate,
+				// (or maybe some other bucket will prove to be viable - but we know that ONE is)
+				// and load in the lower-split of bucket
+				//
+				// also check if hdmaCandidate's first non-gap sequence (that we can see) is within
+				// bucket's gap. this takes into account bucket pairs like so:
+				// -|||-------|||----- <- Bucket 
+				// ------|||------|||- <- hdmaCandidate?
+				// on next iteration of building hdma table, we probably won't match a candidate,
+				// but we probably will have things set up so that maybe hdmaCandidate will split
+				// about the split Bucket when we're looking for buckets to split
+				unsigned char evictionEnd = max(nextAvailableHdmaScanline[hdmaCandidate.scanlineLast],
+					nextAvailableHdmaScanline[hdmaCandidate.scanlineGapEnd - hdmaCandidate.scanlineGapSize]);
+				int evictionStart = prevAvailableHdmaScanline[hdmaCandidate.scanlineFirst];
+				latestEvictionStartByEnd[evictionEnd] = max(latestEvictionStartByEnd[evictionEnd], evictionStart);
+			}
+			for (unsigned int i = 1; i < latestEvictionStartByEnd.size(); ++i)
+			{
+				latestEvictionStartByEnd[i] = max(latestEvictionStartByEnd[i], latestEvictionStartByEnd[i - 1]);
+			}
+
+			auto canSplitOnScanlineGap = [&nextAvailableHdmaScanline, &latestEvictionStartByEnd](const IndexedImageBucketRange& bucket)
+			{
+				// find what scanline this bucket could be loaded in on, first
+				auto scanlineGapEnd = bucket.scanlineGapEnd;
+				auto scanlineGapStart = nextAvailableHdmaScanline[scanlineGapEnd - bucket.scanlineGapSize];
+
+				if (scanlineGapStart >= scanlineGapEnd)
+					return false;
+
+				// then whether there's a bucket that we could split against
+				return latestEvictionStartByEnd[scanlineGapEnd - 1] > (int)scanlineGapStart;
+			};
+
+			// split the earliest bucket that can be. this is a single pass, as building the eviction index above already
+			// is, since each bucket is tested in constant time against the index
+			auto bucketIter = eastl::find_if(bucketRanges.begin(), bucketRanges.end(), canSplitOnScanlineGap);
 	
 			// if a bucket could not positively contribute, then break
 			if (bucketIter == bucketRanges.end())
 				break;
+			unsigned int bucketIdx = (unsigned int)(bucketIter - bucketRanges.begin());
 			
 			// partition bucket about scanline and continue
 			//IndexedImageBucketRange& bucketToSplit = bucketRanges[*bucketIter];
-			auto medianIter = eastl::partition(bucketIter->begin, bucketIter->end,
-				[scanlineSplit = bucketIter->scanlineGapEnd, width = out.srcImg.width](IndexedImageData::const_reference_tuple a)
-				{ return get<const unsigned int&>(a) / width < scanlineSplit; });
+			IndexedImageBucketStats lowerStats;
+			IndexedImageBucketStats upperStats;
+			auto medianIter = bucketIter->partition(
+				[scanlineSplit = bucketIter->scanlineGapEnd](unsigned char, unsigned char, unsigned char, unsigned char scanline)
+				{ return scanline < scanlineSplit; },
+				lowerStats, upperStats);
+			unsigned char splitScanlineLast = bucketIter->scanlineLast;
 			IndexedImageBucketRange& newRange = bucketRanges.push_back();
-			newRange.setBucketRange(medianIter, bucketIter->end, out.srcImg.width);
-			bucketIter->setBucketRange(bucketIter->begin, medianIter, out.srcImg.width);
+			newRange.setBucketRange(medianIter, bucketIter->end, upperStats);
+			bucketIter->setBucketRange(bucketIter->begin, medianIter, lowerStats);
+			onBucketSplit(bucketIdx, splitScanlineLast);
 		}
 	}
 
+	// if every color was bucketed before the palette filled up, the schedule was never generated for the final buckets
+	if (!isHdmaScheduleCurrent)
+		generateHdmaSchedule();
+	bucketTraceScope.end();
+
 	// now that the colors have been bucketed, write out the final results
 	out.palettizedImg.width = out.srcImg.width;
 	out.palettizedImg.height = out.srcImg.height;
@@ -564,12 +1511,23 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 	out.palettizedImg.palette.push_back(0); // add 0 because that's a translucent pixel that should not be used
 
 	// fill out the bucketRanges from the paletteBucketRangeIndices first, to fill out the palettizedImg's base palette,
+	fixed_vector<unsigned char, MaxBuckets, false> bucketPaletteIndices(bucketRanges.size());
 	for (auto baseBucketRangeIndex : paletteBucketRangeIndices)
 	{
 		auto bucket = bucketRanges[baseBucketRangeIndex];
 		auto paletteIdx = (unsigned char)(out.palettizedImg.palette.size());
 		out.palettizedImg.palette.push_back(bucket.getAverageColor());
 		bucket.applyPaletteIndex(out.palettizedImg.data, paletteIdx);
+		bucketPaletteIndices[baseBucketRangeIndex] = paletteIdx;
+	}
+
+	// then map each bucket loaded in via hdma to the palette index of the bucket it evicts. the schedule is generated
+	// by descending scanlineFirst, and an evicted bucket always ends before the bucket that evicts it starts, so it
+	// gets its own population entry (if it was loaded in via hdma) after that one. going through the population list
+	// backwards means an evicted bucket's palette index is always known by the time it's needed
+	for (auto hdmaPopulationIter = hdmaPopulationList.rbegin(); hdmaPopulationIter != hdmaPopulationList.rend(); ++hdmaPopulationIter)
+	{
+		bucketPaletteIndices[hdmaPopulationIter->second] = bucketPaletteIndices[hdmaPopulationIter->first];
 	}
 
 	// next, go through the HDMA population list, to do two things:
@@ -598,27 +1556,7 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 		auto hdmaPopulation = *hdmaPopulationIter;
 
 		// find what paletteIdx this hdma action should occur in
-		unsigned char paletteIdx;
-		{
-			auto bucketIndexToEvict = hdmaPopulation.first;
-			while (true)
-			{
-				auto baseBucketIndexIter = eastl::find(paletteBucketRangeIndices.begin(), paletteBucketRangeIndices.end(), bucketIndexToEvict);
-				// couldn't directly find the baseBucketRange that we're evicting, so we must be evicting something else in the hdmaPopulation
-				if (baseBucketIndexIter == paletteBucketRangeIndices.end())
-				{
-					auto hdmaPopulationIter = eastl::find_if(hdmaPopulationList.begin(), hdmaPopulationList.end(),
-						[bucketIndexToEvict](const pair<unsigned int, unsigned int>& hdmaPopulation)
-						{ return hdmaPopulation.second == bucketIndexToEvict; });
-					bucketIndexToEvict = hdmaPopulationIter->first;
-				}
-				else
-				{
-					paletteIdx = (unsigned char)(baseBucketIndexIter - paletteBucketRangeIndices.begin() + 1);
-					break;
-				}
-			}
-		}
+		unsigned char paletteIdx = bucketPaletteIndices[hdmaPopulation.second];
 
 		auto bucket = bucketRanges[hdmaPopulation.second];
 		HdmaAction hdmaAction;
@@ -661,3 +1599,352 @@ void quantizeToSinglePaletteWithHdma(const ProcessImageParams& params, ProcessIm
 		}
 	}
 }
+
+// replays an image's hdma tables a scanline at a time, the same way getDepalettizedSnesImage does
+struct HdmaPlayback
+{
+	const PalettizedImage& palettizedImg;
+	eastl::fixed_vector<unsigned int, 8, false> hdmaRowIndices;
+	eastl::fixed_vector<unsigned char, 8, false> hdmaLineCounters;
+	PalettizedImage::PaletteTable palette;
+
+	HdmaPlayback(const PalettizedImage& palettizedImg)
+		: palettizedImg(palettizedImg)
+		, hdmaRowIndices(palettizedImg.hdmaTables.size(), 0)
+		, hdmaLineCounters(palettizedImg.hdmaTables.size(), 0)
+		, palette(palettizedImg.palette)
+	{
+	}
+
+	// apply the next scanline's hdma writes to the palette, calling onWrite(paletteIdx) for every entry written to
+	template<typename OnWrite>
+	void nextScanline(OnWrite&& onWrite)
+	{
+		for (unsigned int i = 0; i < palettizedImg.hdmaTables.size(); ++i)
+		{
+			const PalettizedImage::HdmaTable& hdmaTable = palettizedImg.hdmaTables[i];
+			unsigned int hdmaRowIdx = hdmaRowIndices[i];
+			bool isRowFetched = !hdmaLineCounters[i] && hdmaRowIdx < hdmaTable.size();
+			updateHdmaAndPalette(hdmaTable, palette, hdmaLineCounters[i], hdmaRowIndices[i]);
+			if (isRowFetched)
+				onWrite(hdmaTable[hdmaRowIdx].paletteIdx);
+		}
+	}
+};
+
+// finds the nearest color to a px in a palette that hdma keeps changing entries of. each color that's looked up
+// remembers its nearest palette index as of the last palette change it was searched after, so when the color shows up
+// again, only the palette entries that changed since then need to be compared against - unless its nearest entry was
+// one of them, in which case it's searched for again
+struct LivePaletteSearch
+{
+	static const unsigned int NeverSearched = ~0u;
+
+	// nearest colors are looked up by the 15-bit color of the px, and tagged with its full color. two colors that
+	// share a 15-bit color just take turns in the table, since a color that doesn't match the tag gets searched for again
+	struct NearestColor
+	{
+		unsigned int color = 0; // 24-bit tag
+		unsigned int paletteChangeCount = NeverSearched; // how many palette changes had happened when this was last current
+		unsigned int squaredError = 0;
+		unsigned char paletteIdx = 0;
+	};
+
+	// palette colors as they'll be displayed - kept a channel per array, so they can be handed to the ispc kernels as is
+	eastl::array<unsigned char, 256> paletteR, paletteG, paletteB;
+	unsigned int paletteSize;
+	// every palette entry that's changed so far, in the order it changed
+	vector<unsigned char> changedPaletteIndices;
+	// the palette is also kept sorted by green, so a search can start from the entries closest in green and stop once
+	// the green delta alone is worse than the nearest color found so far
+	fixed_vector<unsigned char, 256, false> paletteIndicesByGreen;
+	vector<NearestColor> nearestColors;
+
+	LivePaletteSearch(const PalettizedImage::PaletteTable& palette)
+		: paletteSize((unsigned int)palette.size())
+		, nearestColors(1 << 15)
+	{
+		for (unsigned int i = 0; i < paletteSize; ++i)
+		{
+			Color color = getColorFromSnesColor(palette[i]);
+			paletteR[i] = color.r;
+			paletteG[i] = color.g;
+			paletteB[i] = color.b;
+		}
+
+		// the 0th color is transparent, so it's never searched
+		for (unsigned int i = 1; i < paletteSize; ++i)
+		{
+			paletteIndicesByGreen.push_back((unsigned char)i);
+		}
+		eastl::sort(paletteIndicesByGreen.begin(), paletteIndicesByGreen.end(), [this](unsigned char a, unsigned char b) { return isGreenOrdered(a, b); });
+	}
+
+	bool isGreenOrdered(unsigned char a, unsigned char b) const
+	{
+		return paletteG[a] < paletteG[b] || (paletteG[a] == paletteG[b] && a < b);
+	}
+
+	unsigned int getSquaredError(const Color& px, unsigned int paletteIdx) const
+	{
+		int deltaR = px.r - paletteR[paletteIdx];
+		int deltaG = px.g - paletteG[paletteIdx];
+		int deltaB = px.b - paletteB[paletteIdx];
+		return (unsigned int)(deltaR * deltaR + deltaG * deltaG + deltaB * deltaB);
+	}
+
+	void setColor(unsigned char paletteIdx, unsigned short snesColor)
+	{
+		Color color = getColorFromSnesColor(snesColor);
+		if (paletteIdx == 0 || paletteIdx >= paletteSize || (color.r == paletteR[paletteIdx] && color.g == paletteG[paletteIdx] && color.b == paletteB[paletteIdx]))
+			return;
+
+		// the entry has to come out of the green order by its old color, before going back in by its new one
+		auto isGreenOrderedFn = [this](unsigned char a, unsigned char b) { return isGreenOrdered(a, b); };
+		paletteIndicesByGreen.erase(eastl::lower_bound(paletteIndicesByGreen.begin(), paletteIndicesByGreen.end(), paletteIdx, isGreenOrderedFn));
+		paletteR[paletteIdx] = color.r;
+		paletteG[paletteIdx] = color.g;
+		paletteB[paletteIdx] = color.b;
+		paletteIndicesByGreen.insert(eastl::upper_bound(paletteIndicesByGreen.begin(), paletteIndicesByGreen.end(), paletteIdx, isGreenOrderedFn), paletteIdx);
+		changedPaletteIndices.push_back(paletteIdx);
+	}
+
+	// ties go to the lowest palette index, so the result is the same as searching the whole palette every time
+	unsigned char findNearest(const Color& px)
+	{
+		unsigned int color = (px.r << 16) | (px.g << 8) | px.b;
+		NearestColor& nearest = nearestColors[getSnesColor(px.r, px.g, px.b)];
+		if (nearest.color != color)
+		{
+			nearest.color = color;
+			nearest.paletteChangeCount = NeverSearched;
+		}
+
+		unsigned int paletteChangeCount = (unsigned int)changedPaletteIndices.size();
+		if (nearest.paletteChangeCount == paletteChangeCount)
+			return nearest.paletteIdx;
+
+		// past a palette's worth of changes, it's no slower to just search it all
+		bool isSearchNeeded = nearest.paletteChangeCount == NeverSearched || paletteChangeCount - nearest.paletteChangeCount >= paletteSize;
+		for (unsigned int i = nearest.paletteChangeCount; !isSearchNeeded && i < paletteChangeCount; ++i)
+		{
+			unsigned char paletteIdx = changedPaletteIndices[i];
+			if (paletteIdx == nearest.paletteIdx)
+				isSearchNeeded = true;
+			else
+				considerPaletteIdx(px, paletteIdx, nearest);
+		}
+
+		if (isSearchNeeded)
+		{
+			nearest.squaredError = ~0u;
+
+			// walk out from px's green in both directions, until neither side can hold anything nearer (or as near,
+			// since that could still be a lower index)
+			auto upperIter = eastl::lower_bound(paletteIndicesByGreen.begin(), paletteIndicesByGreen.end(), px.g,
+				[this](unsigned char paletteIdx, unsigned char g) { return paletteG[paletteIdx] < g; });
+			auto lowerIter = upperIter;
+			bool isUpperDone = upperIter == paletteIndicesByGreen.end();
+			bool isLowerDone = lowerIter == paletteIndicesByGreen.begin();
+			while (!isUpperDone || !isLowerDone)
+			{
+				if (!isUpperDone)
+				{
+					if (getGreenSquaredError(px, *upperIter) > nearest.squaredError)
+						isUpperDone = true;
+					else
+					{
+						considerPaletteIdx(px, *upperIter, nearest);
+						isUpperDone = ++upperIter == paletteIndicesByGreen.end();
+					}
+				}
+				if (!isLowerDone)
+				{
+					if (getGreenSquaredError(px, *(lowerIter - 1)) > nearest.squaredError)
+						isLowerDone = true;
+					else
+					{
+						considerPaletteIdx(px, *--lowerIter, nearest);
+						isLowerDone = lowerIter == paletteIndicesByGreen.begin();
+					}
+				}
+			}
+		}
+		nearest.paletteChangeCount = paletteChangeCount;
+		return nearest.paletteIdx;
+	}
+
+	unsigned int getGreenSquaredError(const Color& px, unsigned char paletteIdx) const
+	{
+		int deltaG = px.g - paletteG[paletteIdx];
+		return (unsigned int)(deltaG * deltaG);
+	}
+
+	void considerPaletteIdx(const Color& px, unsigned char paletteIdx, NearestColor& nearest) const
+	{
+		unsigned int squaredError = getSquaredError(px, paletteIdx);
+		if (squaredError < nearest.squaredError || (squaredError == nearest.squaredError && paletteIdx < nearest.paletteIdx))
+		{
+			nearest.squaredError = squaredError;
+			nearest.paletteIdx = paletteIdx;
+		}
+	}
+};
+
+// with hdma, the quantizer maps every pixel by the bucket it ended up in, which isn't necessarily the nearest of the
+// colors live on its scanline, so replay the hdma tables and remap every pixel to its nearest live color
+void remapToNearestLiveColors(ProcessImageStorage& out)
+{
+	const Image& srcImg = out.srcImg;
+	PalettizedImage& palettizedImg = out.palettizedImg;
+	HdmaPlayback hdmaPlayback(palettizedImg);
+	LivePaletteSearch paletteSearch(palettizedImg.palette);
+	for (unsigned int y = 0; y < srcImg.height; ++y)
+	{
+		hdmaPlayback.nextScanline([&](unsigned char paletteIdx) { paletteSearch.setColor(paletteIdx, hdmaPlayback.palette[paletteIdx]); });
+
+		unsigned int pxFirst = y * srcImg.width;
+		for (unsigned int i = pxFirst; i < pxFirst + srcImg.width; ++i)
+		{
+			palettizedImg.data[i] = paletteSearch.findNearest(srcImg.data[i]);
+		}
+	}
+}
+
+// ordered dithering - every px gets an offset from a bayer matrix added to it before it's mapped to its nearest live
+// color. each px only depends on itself, so whole scanlines are mapped at once by the ispc kernel
+void ditherOrdered(int matrixSize, ProcessImageStorage& out)
+{
+	// how far apart the darkest and brightest offsets are. enough to blend neighbouring palette colors, without the
+	// pattern becoming noise where the palette is dense
+	const int Spread = 24;
+
+	static const unsigned char Bayer4[4 * 4] =
+	{
+		0, 8, 2, 10,
+		12, 4, 14, 6,
+		3, 11, 1, 9,
+		15, 7, 13, 5,
+	};
+	static const unsigned char Bayer8[8 * 8] =
+	{
+		0, 32, 8, 40, 2, 34, 10, 42,
+		48, 16, 56, 24, 50, 18, 58, 26,
+		12, 44, 4, 36, 14, 46, 6, 38,
+		60, 28, 52, 20, 62, 30, 54, 22,
+		3, 35, 11, 43, 1, 33, 9, 41,
+		51, 19, 59, 27, 49, 17, 57, 25,
+		15, 47, 7, 39, 13, 45, 5, 37,
+		63, 31, 55, 23, 61, 29, 53, 21,
+	};
+	const unsigned char* bayer = matrixSize == 4 ? Bayer4 : Bayer8;
+	const int MatrixArea = matrixSize * matrixSize;
+
+	// center the thresholds about 0, so the image doesn't get brighter on average
+	eastl::array<int8_t, 8 * 8> thresholds;
+	for (int i = 0; i < MatrixArea; ++i)
+	{
+		thresholds[i] = (int8_t)((2 * bayer[i] + 1 - MatrixArea) * Spread / (2 * MatrixArea));
+	}
+
+	const Image& srcImg = out.srcImg;
+	PalettizedImage& palettizedImg = out.palettizedImg;
+	HdmaPlayback hdmaPlayback(palettizedImg);
+	LivePaletteSearch paletteSearch(palettizedImg.palette);
+	for (unsigned int y = 0; y < srcImg.height; ++y)
+	{
+		hdmaPlayback.nextScanline([&](unsigned char paletteIdx) { paletteSearch.setColor(paletteIdx, hdmaPlayback.palette[paletteIdx]); });
+		ISPC_KERNEL(ditherScanlineOrdered)((uint8_t*)(srcImg.data.data() + y * srcImg.width), (int)srcImg.width,
+			thresholds.data() + (y % matrixSize) * matrixSize, matrixSize,
+			paletteSearch.paletteR.data(), paletteSearch.paletteG.data(), paletteSearch.paletteB.data(), (int)paletteSearch.paletteSize,
+			palettizedImg.data.data() + y * srcImg.width);
+	}
+}
+
+// error diffusion - the difference between every px and the color it's mapped to is spread over the px that haven't
+// been mapped yet. each px depends on the ones before it, so they're mapped one at a time, a scanline at a time, with
+// the nearest color search doing as little work as it can for the colors that repeat (see LivePaletteSearch)
+void ditherErrorDiffusion(Dither dither, ProcessImageStorage& out)
+{
+	// where the error goes, in 16ths. floyd-steinberg spreads all of the error over the next px and the three below,
+	// and goes back and forth across alternate scanlines so the error doesn't drift one way. atkinson only spreads 3/4
+	// of it, over a wider area, which keeps more contrast
+	struct ErrorTarget
+	{
+		int dx, dy, weight;
+	};
+	static const ErrorTarget FloydSteinbergTargets[] = { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } };
+	static const ErrorTarget AtkinsonTargets[] = { { 1, 0, 2 }, { 2, 0, 2 }, { -1, 1, 2 }, { 0, 1, 2 }, { 1, 1, 2 }, { 0, 2, 2 } };
+	const bool IsFloydSteinberg = dither == Dither::FloydSteinberg;
+	const ErrorTarget* targets = IsFloydSteinberg ? FloydSteinbergTargets : AtkinsonTargets;
+	const int TargetCount = IsFloydSteinberg ? 4 : 6;
+	const unsigned int MaxErrorRows = 3;
+
+	// accumulated error is only ever needed for the next couple of scanlines, so it's kept in a ring of rows. a px's
+	// error is cleared once it's been read, so its row is ready to be reused by the time the ring comes back around
+	const Image& srcImg = out.srcImg;
+	const int Width = (int)srcImg.width;
+	vector<eastl::array<int, 3>> errorRows(MaxErrorRows * Width, eastl::array<int, 3>{ 0, 0, 0 });
+	auto getError = [&](int x, unsigned int y) -> eastl::array<int, 3>&
+	{
+		return errorRows[(y % MaxErrorRows) * Width + x];
+	};
+	auto roundSixteenths = [](int sixteenths)
+	{
+		return (sixteenths >= 0 ? sixteenths + 8 : sixteenths - 8) / 16;
+	};
+
+	PalettizedImage& palettizedImg = out.palettizedImg;
+	HdmaPlayback hdmaPlayback(palettizedImg);
+	LivePaletteSearch paletteSearch(palettizedImg.palette);
+	for (unsigned int y = 0; y < srcImg.height; ++y)
+	{
+		hdmaPlayback.nextScanline([&](unsigned char paletteIdx) { paletteSearch.setColor(paletteIdx, hdmaPlayback.palette[paletteIdx]); });
+
+		bool isReversed = IsFloydSteinberg && (y & 1);
+		int direction = isReversed ? -1 : 1;
+		for (int i = 0; i < Width; ++i)
+		{
+			int x = isReversed ? Width - 1 - i : i;
+			unsigned int pxIdx = y * srcImg.width + x;
+			const Color& srcPx = srcImg.data[pxIdx];
+			eastl::array<int, 3>& error = getError(x, y);
+			Color px;
+			px.r = (unsigned char)min(max(srcPx.r + roundSixteenths(error[0]), 0), 255);
+			px.g = (unsigned char)min(max(srcPx.g + roundSixteenths(error[1]), 0), 255);
+			px.b = (unsigned char)min(max(srcPx.b + roundSixteenths(error[2]), 0), 255);
+			error = { 0, 0, 0 };
+
+			unsigned char paletteIdx = paletteSearch.findNearest(px);
+			palettizedImg.data[pxIdx] = paletteIdx;
+
+			int errorR = px.r - paletteSearch.paletteR[paletteIdx];
+			int errorG = px.g - paletteSearch.paletteG[paletteIdx];
+			int errorB = px.b - paletteSearch.paletteB[paletteIdx];
+			for (int targetIdx = 0; targetIdx < TargetCount; ++targetIdx)
+			{
+				const ErrorTarget& target = targets[targetIdx];
+				int targetX = x + target.dx * direction;
+				if (targetX < 0 || targetX >= Width)
+					continue;
+
+				eastl::array<int, 3>& targetError = getError(targetX, y + target.dy);
+				targetError[0] += errorR * target.weight;
+				targetError[1] += errorG * target.weight;
+				targetError[2] += errorB * target.weight;
+			}
+		}
+	}
+}
+
+void ditherToLiveColors(const ProcessImageParams& params, ProcessImageStorage& out)
+{
+	switch (params.dither)
+	{
+	case Dither::Bayer4: ditherOrdered(4, out); break;
+	case Dither::Bayer8: ditherOrdered(8, out); break;
+	case Dither::FloydSteinberg:
+	case Dither::Atkinson: ditherErrorDiffusion(params.dither, out); break;
+	default: break;
+	}
+}
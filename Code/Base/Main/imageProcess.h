@@ -2,25 +2,73 @@
 
 #include "imageCommon.h"
 
+#include <string_view>
+
+// how the colors of an image get bucketed into its palette, when there's no hdma
+enum class Quantizer
+{
+	MedianCut, // repeatedly split the bucket with the widest channel range about its midpoint
+	Wu, // repeatedly split the box of the 15-bit color cube that leaves the least variance (Xiaolin Wu's method)
+};
+
+// how px are mapped to the palette colors live on their scanline
+enum class Dither
+{
+	None, // every px takes its nearest color
+	Bayer4, // ordered, with a 4x4 bayer matrix
+	Bayer8, // ordered, with an 8x8 bayer matrix
+	FloydSteinberg, // error diffusion, spreading all of the error over the 4 px ahead
+	Atkinson, // error diffusion, spreading 3/4 of the error over the 6 px ahead
+};
+
 struct ProcessImageParams
 {
+	// generate 4bpp (or 2bpp) tiles, with every 8x8 tile picking one of up to maxPalettes 16c (or 4c) palettes, rather
+	// than a single 8bpp palette. hdma and dithering aren't supported with it
+	bool lowBitDepthPalette = false;
 	// only acknowledged if lowBitDepthPalette is true - the maximum number of 16c palettes that will be generated
-	int maxPalettes;
+	int maxPalettes = 8;
+	// only acknowledged if lowBitDepthPalette is true - 4 for 16c palettes, or 2 for 4c palettes
+	int tileBitsPerPixel = 4;
 	// only acknowledged if lowBitDepthPalette is false - the maximum number of colors that will be generated across
 	int maxColors;
 
-	// the total number of hdmaChannels that will be utilized in the output
+	// only acknowledged if lowBitDepthPalette is false - the total number of hdmaChannels that will be utilized in the output
 	int maxHdmaChannels;
+	// only acknowledged without hdma (maxHdmaChannels is 0, or lowBitDepthPalette is true) - how the palette (or each
+	// 16c palette) is picked
+	Quantizer quantizer = Quantizer::MedianCut;
+	// only acknowledged without hdma (maxHdmaChannels is 0, or lowBitDepthPalette is true) - the maximum number of
+	// k-means passes to refine the picked palette (or each 16c palette) with
+	int refineIterations = 0;
+	// only acknowledged if lowBitDepthPalette is false - how px are mapped to the colors live on their scanline once
+	// the palette (and hdma) is picked, in place of remapping each px to its nearest color. works with or without hdma
+	Dither dither = Dither::None;
 
 	std::filesystem::path inFilePath;
 	std::filesystem::path outDirPath;
+	OutputFormat outFormat = OutputFormat::Files;
+	// ImageOutputFlags for every output to generate
+	unsigned int outputs = ImageOutput_All;
 };
 
 Image getDepalettizedImage(const PalettizedImage& palettizedImg);
 eastl::vector<unsigned short> getDepalettizedSnesImage(const PalettizedImage& palettizedImg);
+// expand an already-depalettized snes image (i.e. from getDepalettizedSnesImage) out to 24-bit rgb
+Image getImageFromSnesImage(const eastl::vector<unsigned short>& snesImgData, unsigned int width, unsigned int height);
 Image getQuantizedImage(const Image& srcImg);
 
 void processImage(const ProcessImageParams& params, ProcessImageStorage& out);
 
+// parse a quantizer name (mediancut or wu)
+bool parseQuantizer(std::string_view name, Quantizer& outQuantizer);
+// parse a dither name (none, bayer4, bayer8, fs or atkinson)
+bool parseDither(std::string_view name, Dither& outDither);
+
+// force the ispc kernels onto one instruction set - "sse2", "sse4", "avx2" or "avx512skx" - instead of the best one the
+// cpu supports ("auto", the default). returns false for an unknown target. meant for benchmarking; forcing one the cpu
+// doesn't support will crash
+bool setIspcTarget(std::string_view target);
+
 // utility for use when depalettizing the image based on hdma data
 void updateHdmaAndPalette(const PalettizedImage::HdmaTable &hdmaTable, PalettizedImage::PaletteTable &activePalette, unsigned char &hdmaLineCounter, unsigned int &hdmaRowIdx);
@@ -2,13 +2,25 @@
 
 #include <filesystem>
 
+#include "imageArtifacts.h"
 #include "imageCommon.h"
 
+class IoQueue;
+class PackWriter;
+
 Image loadImage(const std::filesystem::path& filename);
+void writeToFile(const ByteBuffer& buffer, const std::filesystem::path& filePath);
+
+// hand every artifact's data over to the io queue to be written out - the artifacts are left without any data
+void writeImageArtifacts(ImageArtifactList& artifacts, IoQueue& ioQueue);
+
+// append every artifact into a pack shared by a whole batch, with each section prefixed by the image's name
+void writeImageArtifactsToBatchPack(const ProcessImageParams& params, const ImageArtifactList& artifacts, PackWriter& batchPack);
+
 void saveImage(const Image& img, const std::filesystem::path& file);
 void savePalettizedImage(const PalettizedImage& pltImg, const std::filesystem::path& file);
 void saveSnesPalette(const PalettizedImage::PaletteTable& palette, const std::filesystem::path& file);
 void saveSnesTiles(const PalettizedImage& img, const std::filesystem::path& file);
-void saveSnesTilemap(unsigned int width, unsigned int height, const std::filesystem::path& file);
+void saveSnesTilemap(const PalettizedImage& img, const std::filesystem::path& file);
 void saveSnesHdmaTable(const PalettizedImage& img, const std::filesystem::path &file);
-void saveImageStatistics(const ProcessImageStorage& storage, const std::filesystem::path &file);
\ No newline at end of file
+void saveImageStatistics(const ProcessImageStorage& storage, const std::filesystem::path &file);
@@ -2,90 +2,68 @@
 
 #include <External/flags/include/flags.h>
 
+#include <Core/ioQueue.h>
+#include <Core/taskScheduler.h>
+#include <Core/trace.h>
+#include <Main/batchPipeline.h>
+#include <Main/imageArtifacts.h>
+#include <Main/imageCache.h>
 #include <Main/imageIo.h>
 #include <Main/imageNtscFilter.h>
 #include <Main/imageProcess.h>
+#include <Main/packArchive.h>
+#include <Main/serverMode.h>
 
-void processFile(const ProcessImageParams &params)
+#include <fstream>
+
+void processFile(const ProcessImageParams &params, ImageCache* cache, IoQueue& ioQueue)
 {
 	ProcessImageStorage storage;
 
 	// load image in and process it according to parameters set above
+	TraceScope loadTraceScope("load", params.inFilePath);
 	storage.srcImg = loadImage(params.inFilePath);
 
-	// if the file wasn't an image, skip out
-	if (storage.srcImg.data.size() == 0)
-		return;
-
-	// if the image was too big on either dimension, skip out
-	if (storage.srcImg.width > MaxWidth || storage.srcImg.height > MaxHeight)
+	// if the file wasn't an image, or was too big on either dimension, skip out
+	if (!isProcessableImage(storage.srcImg))
 		return;
 
-	processImage(params, storage);
-	Concurrency::parallel_invoke(
-		// write out 15b quantized source
-		[&params, &storage]
-		{
-			std::filesystem::path outPngPath = params.outDirPath / params.inFilePath.stem().concat("-src.png");
-			saveImage(getQuantizedImage(storage.srcImg), outPngPath);
-		},
-
-		// write out raw as png
-		[&params, &storage]
-		{
-			std::filesystem::path outPngPath = params.outDirPath / params.inFilePath.stem().concat(".png");
-			saveImage(getDepalettizedImage(storage.palettizedImg), outPngPath);
-		},
-
-		// write out ntsc-processed png
-		[&params, &storage]
-		{
-			std::filesystem::path outFilteredPngPath = params.outDirPath / params.inFilePath.stem().concat("-filtered.png");
-			saveImage(applyNtscFilter(storage.palettizedImg), outFilteredPngPath);
-		},
+	// if nothing that feeds into the outputs has changed since they were last written, skip out
+	uint64_t cacheKey = 0;
+	if (cache)
+	{
+		cacheKey = ImageCache::computeKey(params, storage.srcImg);
+		if (cache->isUpToDate(params, cacheKey))
+			return;
+	}
+	loadTraceScope.end();
 
-		// write out palette information
-		[&params, &storage]
-		{
-			std::filesystem::path outPltImgPath = params.outDirPath / params.inFilePath.stem().concat("-pltidx.png");
-			savePalettizedImage(storage.palettizedImg, outPltImgPath);
-		},
+	{
+		TraceScope traceScope("process", params.inFilePath);
+		processImage(params, storage);
+	}
 
-		// write out palette data
-		[&params, &storage]
-		{
-			std::filesystem::path outSnesPltImgPath = params.outDirPath / params.inFilePath.stem().concat(".clr");
-			saveSnesPalette(storage.palettizedImg.palette, outSnesPltImgPath);
-		},
+	ImageArtifactList artifacts;
+	{
+		TraceScope traceScope("encode", params.inFilePath);
+		artifacts = encodeImageArtifacts(params, storage);
+	}
 
-		// write out tile data
-		[&params, &storage]
-		{
-			std::filesystem::path outSnesTileImgPath = params.outDirPath / params.inFilePath.stem().concat(".pic");
-			saveSnesTiles(storage.palettizedImg, outSnesTileImgPath);
-		},
+	TraceScope writeTraceScope("write", params.inFilePath);
+	writeImageArtifacts(artifacts, ioQueue);
 
-		// write out tilemap data
-		[&params, &storage]
-		{
-			std::filesystem::path outSnesMapImgPath = params.outDirPath / params.inFilePath.stem().concat(".map");
-			saveSnesTilemap(storage.palettizedImg.width, storage.palettizedImg.height, outSnesMapImgPath);
-		},
+	if (cache)
+		cache->update(params, cacheKey, artifacts);
+}
 
-		// write out hdma table
-		[&params, &storage]
-		{
-			std::filesystem::path outSnesHmdaImgPath = params.outDirPath / params.inFilePath.stem().concat(".hdma");
-			saveSnesHdmaTable(storage.palettizedImg,outSnesHmdaImgPath);
-		},
+bool writeTrace(const std::filesystem::path& tracePath)
+{
+	std::ofstream traceFile(tracePath, std::ios::trunc);
+	if (!traceFile)
+		return false;
 
-		// calculate/report stats
-		[&params, &storage]
-		{
-			std::filesystem::path outStatsImgPath = params.outDirPath / params.inFilePath.stem().concat(".txt");
-			saveImageStatistics(storage, outStatsImgPath);
-		}
-	);
+	Tracer::writeChromeJson(traceFile);
+	return true;
 }
 
 int main(int argc, char** argv)
@@ -93,22 +71,29 @@ int main(int argc, char** argv)
 	// load in necessary command line arguments
 	const flags::args args(argc, argv);
 	const auto inFile = args.get<std::string_view>("in");
+	const auto outDir = args.get<std::string_view>("outDir");
 
-	if (!inFile.has_value())
-	{
-		std::cout << "Missing input file or directory as cli arg: \"in=<file/dir>\"";
-		return 1;
-	}
+	// in server mode, the input and output come with each job instead
+	const bool serve = args.get<bool>("serve", false);
+	const auto serveSocket = args.get<std::string_view>("socket", "");
 
-	const auto outDir = args.get<std::string_view>("outDir");
-	if (!outDir.has_value() || !std::filesystem::is_directory(outDir.value()))
+	if (!serve)
 	{
-		std::cout << "Missing output dir as cli arg: \"outDir=<directory>\"";
-		return 1;
+		if (!inFile.has_value())
+		{
+			std::cout << "Missing input file or directory as cli arg: \"in=<file/dir>\"";
+			return 1;
+		}
+
+		if (!outDir.has_value() || !std::filesystem::is_directory(outDir.value()))
+		{
+			std::cout << "Missing output dir as cli arg: \"outDir=<directory>\"";
+			return 1;
+		}
 	}
 
-	std::filesystem::path outDirPath = outDir.value();
-	std::filesystem::path inFilePath = inFile.value();
+	std::filesystem::path outDirPath = outDir.value_or("");
+	std::filesystem::path inFilePath = inFile.value_or("");
 
 	const auto hdmaChannels = args.get<int>("hdmaChannels", 0);
 	if (hdmaChannels < 0 || hdmaChannels > 8)
@@ -124,29 +109,215 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	const auto tilePalettes = args.get<int>("tilePalettes", 0);
+	if (tilePalettes < 0 || tilePalettes > 8)
+	{
+		std::cout << "Invalid number of tile palettes specified. Only values between 0 and 8 are accepted";
+		return 1;
+	}
+	if (tilePalettes > 0 && hdmaChannels > 0)
+	{
+		std::cout << "Tile palettes can't be used with hdma channels";
+		return 1;
+	}
+
+	const auto tileBpp = args.get<int>("tileBpp", 4);
+	if (tileBpp != 2 && tileBpp != 4)
+	{
+		std::cout << "Invalid tile bpp specified. Only 2 and 4 are accepted";
+		return 1;
+	}
+
+	const auto quantizerName = args.get<std::string_view>("quantizer", "mediancut");
+	Quantizer quantizer;
+	if (!parseQuantizer(quantizerName, quantizer))
+	{
+		std::cout << "Invalid quantizer specified. Only \"mediancut\" and \"wu\" are accepted";
+		return 1;
+	}
+
+	const auto refineIterations = args.get<int>("refine", 0);
+	if (refineIterations < 0)
+	{
+		std::cout << "Invalid number of refine iterations specified. Use 0 to skip refining the palette";
+		return 1;
+	}
+
+	if (hdmaChannels > 0 && (quantizer != Quantizer::MedianCut || refineIterations > 0))
+	{
+		std::cout << "Quantizers other than mediancut and refining can't be used with hdma channels";
+		return 1;
+	}
+
+	const auto ditherName = args.get<std::string_view>("dither", "none");
+	Dither dither;
+	if (!parseDither(ditherName, dither))
+	{
+		std::cout << "Invalid dither specified. Only \"none\", \"bayer4\", \"bayer8\", \"fs\" and \"atkinson\" are accepted";
+		return 1;
+	}
+	if (tilePalettes > 0 && dither != Dither::None)
+	{
+		std::cout << "Dithering can't be used with tile palettes";
+		return 1;
+	}
+
+	const auto threads = args.get<int>("threads", 0);
+	if (threads < 0)
+	{
+		std::cout << "Invalid number of threads specified. Use 0 to run on every hardware thread";
+		return 1;
+	}
+
+	const auto outFormat = args.get<std::string_view>("outFormat", "files");
+	OutputFormat outputFormat;
+	if (outFormat == "files")
+		outputFormat = OutputFormat::Files;
+	else if (outFormat == "pack")
+		outputFormat = OutputFormat::Pack;
+	else if (outFormat == "packBatch")
+		outputFormat = OutputFormat::PackBatch;
+	else
+	{
+		std::cout << "Invalid output format specified. Only \"files\", \"pack\" and \"packBatch\" are accepted";
+		return 1;
+	}
+
+	const auto outputList = args.get<std::string_view>("outputs", "all");
+	unsigned int outputs;
+	if (!parseImageOutputs(outputList, outputs))
+	{
+		std::cout << "Invalid outputs specified. Use a comma-separated list of \"src\", \"png\", \"filtered\", \"pltidx\", \"clr\", \"pic\", \"map\", \"hdma\", \"stats\" or \"all\"";
+		return 1;
+	}
+
+	BatchPipelineLimits pipelineLimits;
+	const auto loadThreads = args.get<int>("loadThreads", pipelineLimits.loadThreads);
+	const auto processThreads = args.get<int>("processThreads", pipelineLimits.processThreads);
+	const auto encodeThreads = args.get<int>("encodeThreads", pipelineLimits.encodeThreads);
+	const auto writeThreads = args.get<int>("writeThreads", pipelineLimits.writeThreads);
+	const auto queueDepth = args.get<int>("queueDepth", pipelineLimits.queueDepth);
+	if (loadThreads < 1 || processThreads < 0 || encodeThreads < 1 || writeThreads < 1 || queueDepth < 1)
+	{
+		std::cout << "Invalid pipeline limits specified. loadThreads, encodeThreads, writeThreads and queueDepth must be at least 1, and processThreads at least 0";
+		return 1;
+	}
+	pipelineLimits.loadThreads = loadThreads;
+	pipelineLimits.processThreads = processThreads;
+	pipelineLimits.encodeThreads = encodeThreads;
+	pipelineLimits.writeThreads = writeThreads;
+	pipelineLimits.queueDepth = queueDepth;
+
+	const auto ioThreads = args.get<int>("ioThreads", 2);
+	if (ioThreads < 1)
+	{
+		std::cout << "Invalid number of io threads specified. At least 1 is required";
+		return 1;
+	}
+
+	const auto ioMaxMegabytes = args.get<int>("ioMaxMegabytes", 256);
+	if (ioMaxMegabytes < 0)
+	{
+		std::cout << "Invalid io memory limit specified. Use 0 to let any amount of data be queued up for writing";
+		return 1;
+	}
+
+	const auto fsync = args.get<std::string_view>("fsync", "none");
+	FsyncPolicy fsyncPolicy;
+	if (fsync == "none")
+		fsyncPolicy = FsyncPolicy::None;
+	else if (fsync == "file")
+		fsyncPolicy = FsyncPolicy::PerFile;
+	else if (fsync == "batch")
+		fsyncPolicy = FsyncPolicy::PerBatch;
+	else
+	{
+		std::cout << "Invalid fsync policy specified. Only \"none\", \"file\" and \"batch\" are accepted";
+		return 1;
+	}
+
+	const bool ioStats = args.get<bool>("ioStats", false);
+
+	const auto ispcTarget = args.get<std::string_view>("ispcTarget", "auto");
+	if (!setIspcTarget(ispcTarget))
+	{
+		std::cout << "Invalid ispc target specified. Only \"auto\", \"sse2\", \"sse4\", \"avx2\" and \"avx512skx\" are accepted";
+		return 1;
+	}
+
+	// the incremental cache is on by default; its manifest lives alongside the outputs
+	// a batch pack is rebuilt from scratch every run though, so every image needs to be processed into it
+	const bool noCache = args.get<bool>("noCache", false);
+	std::unique_ptr<ImageCache> cache;
+	if (!serve && !noCache && outputFormat != OutputFormat::PackBatch)
+		cache.reset(new ImageCache(outDirPath / "background-processor.cache"));
+
+	// spans are recorded from here on, so the trace covers thread pool and ntsc filter setup too
+	const auto tracePath = std::filesystem::path(args.get<std::string_view>("trace", ""));
+	if (!tracePath.empty())
+	{
+		Tracer::enable();
+		Tracer::setThreadName("main");
+	}
+
+	TaskScheduler::init((unsigned int)threads);
+	initNtscFilter();
+
+	IoQueue ioQueue((unsigned int)ioThreads, fsyncPolicy, (unsigned long long)ioMaxMegabytes * 1024 * 1024);
 
 	ProcessImageParams params;
 	params.maxHdmaChannels = hdmaChannels;
 	params.maxColors = paletteSize;
+	params.lowBitDepthPalette = tilePalettes > 0;
+	if (params.lowBitDepthPalette)
+		params.maxPalettes = tilePalettes;
+	params.tileBitsPerPixel = tileBpp;
+	params.quantizer = quantizer;
+	params.refineIterations = refineIterations;
+	params.dither = dither;
 	params.outDirPath = outDirPath;
-	if (std::filesystem::is_regular_file(inFilePath))
+	params.outFormat = outputFormat;
+	params.outputs = outputs;
+	if (serve)
 	{
+		int serverResult = runServer(params, serveSocket, ioQueue);
+		ioQueue.flush();
+		if (!tracePath.empty() && !writeTrace(tracePath))
+			std::cout << "Could not write trace to: " << tracePath.c_str();
+		return serverResult;
+	}
+	else if (std::filesystem::is_regular_file(inFilePath))
+	{
+		// a batch of one is just a pack for the image
+		if (params.outFormat == OutputFormat::PackBatch)
+			params.outFormat = OutputFormat::Pack;
+
 		params.inFilePath = inFilePath;
-		processFile(params);
+		processFile(params, cache.get(), ioQueue);
 	}
 	else if (std::filesystem::is_directory(inFilePath))
 	{
-		Concurrency::task_group tasks;
-		for (const auto& entry : std::filesystem::directory_iterator(inFilePath))
+		std::unique_ptr<PackWriter> batchPack;
+		if (params.outFormat == OutputFormat::PackBatch)
 		{
-			if (is_regular_file(entry.path()))
+			// the batch pack is named after the input directory
+			std::filesystem::path batchName = inFilePath.filename();
+			if (batchName.empty())
+				batchName = inFilePath.parent_path().filename();
+			batchPack.reset(new PackWriter(outDirPath / batchName.concat(".bpk")));
+			if (!batchPack->isOpen())
 			{
-				params.inFilePath = entry.path();
-				// value-copy of params is intentional; a copy of the params is made and the task executes on that
-				tasks.run([params]{ processFile(params); });
+				std::cout << "Could not open batch pack for writing in output directory: " << outDirPath.c_str();
+				return 1;
 			}
 		}
-		tasks.wait();
+
+		processDirectory(params, inFilePath, pipelineLimits, cache.get(), batchPack.get(), ioQueue);
+		if (batchPack && !batchPack->close())
+		{
+			std::cout << "Could not write batch pack to output directory: " << outDirPath.c_str();
+			return 1;
+		}
 	}
 	else
 	{
@@ -154,5 +325,24 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	// everything has to actually be on disk before the cache can vouch for it
+	ioQueue.flush();
+	if (cache)
+		cache->save();
+
+	if (ioStats)
+	{
+		IoQueueStats stats = ioQueue.getStats();
+		std::cout << "Files written: " << stats.filesWritten << " (" << stats.writeErrors << " errors)\n";
+		std::cout << "Bytes written: " << stats.bytesWritten << " in " << stats.batchesSubmitted << " batches\n";
+		std::cout << "Peak queue depth: " << stats.peakQueueDepth << " files, " << stats.peakBytesInFlight << " bytes\n";
+	}
+
+	if (!tracePath.empty() && !writeTrace(tracePath))
+	{
+		std::cout << "Could not write trace to: " << tracePath.c_str();
+		return 1;
+	}
+
 	return 0;
 }
@@ -0,0 +1,77 @@
+#include "Pch.h"
+
+#include "packArchive.h"
+
+PackWriter::PackWriter(ByteBuffer& outBuffer)
+	: m_buffer(&outBuffer)
+{
+	PackHeader header = { PackMagic, PackVersion, PackAlignment, 0 };
+	write(&header, sizeof(header));
+}
+
+PackWriter::~PackWriter()
+{
+	close();
+}
+
+void PackWriter::addSection(const eastl::string& name, const ByteBuffer& data)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!isOpen())
+		return;
+
+	PackIndexEntry entry;
+	entry.offset = m_offset;
+	entry.size = data.size();
+	entry.nameOffset = (unsigned int)m_names.size();
+	entry.nameLength = (unsigned int)name.size();
+	m_index.push_back(entry);
+	m_names += name;
+
+	write(data.data(), data.size());
+
+	const unsigned char padding[PackAlignment] = {};
+	size_t paddingSize = (PackAlignment - (m_offset % PackAlignment)) % PackAlignment;
+	write(padding, paddingSize);
+}
+
+bool PackWriter::close()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!isOpen())
+		return !m_writeFailed;
+
+	PackFooter footer;
+	footer.indexOffset = m_offset;
+	footer.sectionCount = (unsigned int)m_index.size();
+	footer.magic = PackMagic;
+
+	write(m_index.data(), m_index.size() * sizeof(PackIndexEntry));
+	write(m_names.data(), m_names.size());
+	write(&footer, sizeof(footer));
+
+	if (m_file && fclose(m_file) != 0)
+		m_writeFailed = true;
+	m_file = nullptr;
+	m_buffer = nullptr;
+	return !m_writeFailed;
+}
+
+void PackWriter::write(const void* data, size_t size)
+{
+	if (size == 0 || m_writeFailed)
+		return;
+
+	if (m_file)
+	{
+		if (fwrite(data, 1, size, m_file) != size)
+			m_writeFailed = true;
+	}
+	else
+	{
+		auto oldSize = m_buffer->size();
+		m_buffer->resize(oldSize + size);
+		memcpy(m_buffer->data() + oldSize, data, size);
+	}
+	m_offset += size;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+
+#include <EASTL/string.h>
+
+#include "imageCommon.h"
+
+// Pack archive: a single container holding any number of named, aligned sections
+// Everything is written front to back in a single pass, so the index lives at the end of the file:
+//   header   - PackHeader
+//   sections - each blob padded out to PackAlignment
+//   index    - PackIndexEntry per section
+//   names    - every section name, back to back, without terminators
+//   footer   - PackFooter, which locates the index
+// All values are little-endian.
+
+const unsigned int PackMagic = 0x4b504742; // "BGPK"
+const unsigned int PackVersion = 1;
+const unsigned int PackAlignment = 16;
+
+struct PackHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int alignment;
+	unsigned int reserved;
+};
+
+struct PackIndexEntry
+{
+	unsigned long long offset; // from the start of the file
+	unsigned long long size;
+	unsigned int nameOffset; // from the start of the names block
+	unsigned int nameLength;
+};
+
+struct PackFooter
+{
+	unsigned long long indexOffset;
+	unsigned int sectionCount;
+	unsigned int magic;
+};
+
+class PackWriter
+{
+public:
+	// stream the pack into the provided buffer
+	explicit PackWriter(ByteBuffer& outBuffer);
+	// stream the pack out to a file. this lives in packArchiveFile.cpp, which is only built into the executable, so
+	// that libbackgroundprocessor never opens files itself
+	explicit PackWriter(const std::filesystem::path& outPath);
+	~PackWriter();
+
+	bool isOpen() const { return m_buffer || m_file; }
+
+	// thread-safe, so a single pack can be shared by every writer in a batch
+	void addSection(const eastl::string& name, const ByteBuffer& data);
+
+	// write out the index and footer. no more sections can be added after this
+	// returns false if any of the pack couldn't be written (i.e. the disk filled up), in which case the file is incomplete
+	bool close();
+
+private:
+	void write(const void* data, size_t size);
+
+	std::mutex m_lock;
+	ByteBuffer* m_buffer = nullptr;
+	FILE* m_file = nullptr;
+	// sticky - once a write has failed, the rest of the file is meaningless, so nothing more is written
+	bool m_writeFailed = false;
+	unsigned long long m_offset = 0;
+	eastl::vector<PackIndexEntry> m_index;
+	eastl::string m_names;
+};
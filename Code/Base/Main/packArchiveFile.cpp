@@ -0,0 +1,15 @@
+#include "Pch.h"
+
+#include <Core/ioQueue.h>
+
+#include "packArchive.h"
+
+PackWriter::PackWriter(const std::filesystem::path& outPath)
+{
+	m_file = openForWrite(outPath);
+	if (!m_file)
+		return;
+
+	PackHeader header = { PackMagic, PackVersion, PackAlignment, 0 };
+	write(&header, sizeof(header));
+}
@@ -0,0 +1,574 @@
+#include "Pch.h"
+
+#include "serverMode.h"
+
+#include <Core/ioQueue.h>
+#include <Main/backgroundProcessor.h>
+#include <Main/imageio.h>
+
+#include <EASTL/algorithm.h>
+#include <EASTL/hash_map.h>
+#include <EASTL/string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// buffered, blocking reads and writes over a pair of file descriptors (stdin/stdout, or both ends of a socket)
+	class ServerStream
+	{
+	public:
+		ServerStream(int inFd, int outFd)
+			: m_inFd(inFd)
+			, m_outFd(outFd)
+		{
+		}
+
+		bool readLine(eastl::string& outLine)
+		{
+			outLine.clear();
+			while (true)
+			{
+				if (m_readPos == m_readEnd && !fill())
+					return !outLine.empty();
+
+				char c = m_readBuffer[m_readPos++];
+				if (c == '\n')
+					return true;
+				if (c != '\r')
+					outLine.push_back(c);
+			}
+		}
+
+		bool readBytes(void* data, size_t size)
+		{
+			unsigned char* dst = static_cast<unsigned char*>(data);
+			while (size > 0)
+			{
+				if (m_readPos == m_readEnd && !fill())
+					return false;
+
+				size_t chunk = eastl::min(size, m_readEnd - m_readPos);
+				memcpy(dst, m_readBuffer + m_readPos, chunk);
+				m_readPos += chunk;
+				dst += chunk;
+				size -= chunk;
+			}
+			return true;
+		}
+
+		bool write(const void* data, size_t size)
+		{
+			const unsigned char* src = static_cast<const unsigned char*>(data);
+			while (size > 0)
+			{
+#ifdef _WIN32
+				int written = _write(m_outFd, src, (unsigned int)size);
+#else
+				ssize_t written = ::write(m_outFd, src, size);
+#endif
+				if (written <= 0)
+					return false;
+				src += written;
+				size -= written;
+			}
+			return true;
+		}
+
+		bool writeLine(const eastl::string& line)
+		{
+			return write(line.data(), line.size()) && write("\n", 1);
+		}
+
+	private:
+		bool fill()
+		{
+#ifdef _WIN32
+			int bytesRead = _read(m_inFd, m_readBuffer, sizeof(m_readBuffer));
+#else
+			ssize_t bytesRead = ::read(m_inFd, m_readBuffer, sizeof(m_readBuffer));
+#endif
+			if (bytesRead <= 0)
+				return false;
+			m_readPos = 0;
+			m_readEnd = bytesRead;
+			return true;
+		}
+
+		int m_inFd;
+		int m_outFd;
+		char m_readBuffer[64 * 1024];
+		size_t m_readPos = 0;
+		size_t m_readEnd = 0;
+	};
+
+	typedef eastl::hash_map<eastl::string, eastl::string> RequestArgs;
+
+	// split a request into its command, and key=value arguments
+	bool parseRequest(const eastl::string& line, eastl::string& outCommand, RequestArgs& outArgs)
+	{
+		outCommand.clear();
+		outArgs.clear();
+
+		size_t pos = 0;
+		while (pos < line.size())
+		{
+			while (pos < line.size() && line[pos] == ' ')
+				++pos;
+			if (pos == line.size())
+				break;
+
+			eastl::string key;
+			eastl::string value;
+			while (pos < line.size() && line[pos] != ' ' && line[pos] != '=')
+				key.push_back(line[pos++]);
+
+			if (pos < line.size() && line[pos] == '=')
+			{
+				++pos;
+				bool quoted = pos < line.size() && line[pos] == '"';
+				if (quoted)
+					++pos;
+				while (pos < line.size() && (quoted ? line[pos] != '"' : line[pos] != ' '))
+					value.push_back(line[pos++]);
+				if (quoted)
+				{
+					if (pos == line.size())
+						return false;
+					++pos;
+				}
+			}
+
+			if (outCommand.empty())
+				outCommand = key;
+			else
+				outArgs[key] = value;
+		}
+		return !outCommand.empty();
+	}
+
+	bool getIntArg(const RequestArgs& args, const char* key, int defaultValue, int& outValue)
+	{
+		auto argIter = args.find(key);
+		if (argIter == args.end())
+		{
+			outValue = defaultValue;
+			return true;
+		}
+
+		char* end;
+		outValue = (int)strtol(argIter->second.c_str(), &end, 10);
+		return !argIter->second.empty() && *end == 0;
+	}
+
+	// fill out the params for a job, validating them the same way main does
+	bool getJobParams(const ProcessImageParams& defaultParams, const RequestArgs& args, ProcessImageParams& outParams, eastl::string& outError)
+	{
+		outParams = defaultParams;
+		if (!getIntArg(args, "hdmaChannels", defaultParams.maxHdmaChannels, outParams.maxHdmaChannels) ||
+			outParams.maxHdmaChannels < 0 || outParams.maxHdmaChannels > 8)
+		{
+			outError = "invalid hdmaChannels - only values between 0 and 8 are accepted";
+			return false;
+		}
+
+		if (!getIntArg(args, "paletteSize", defaultParams.maxColors, outParams.maxColors) ||
+			outParams.maxColors < 2 || outParams.maxColors > 256)
+		{
+			outError = "invalid paletteSize - only values between 2 and 256 are accepted";
+			return false;
+		}
+
+		int tilePalettes;
+		if (!getIntArg(args, "tilePalettes", defaultParams.lowBitDepthPalette ? defaultParams.maxPalettes : 0, tilePalettes) ||
+			tilePalettes < 0 || tilePalettes > 8)
+		{
+			outError = "invalid tilePalettes - only values between 0 and 8 are accepted";
+			return false;
+		}
+		if (tilePalettes > 0 && outParams.maxHdmaChannels > 0)
+		{
+			outError = "tilePalettes can't be used with hdmaChannels";
+			return false;
+		}
+		outParams.lowBitDepthPalette = tilePalettes > 0;
+		if (outParams.lowBitDepthPalette)
+			outParams.maxPalettes = tilePalettes;
+
+		if (!getIntArg(args, "tileBpp", defaultParams.tileBitsPerPixel, outParams.tileBitsPerPixel) ||
+			(outParams.tileBitsPerPixel != 2 && outParams.tileBitsPerPixel != 4))
+		{
+			outError = "invalid tileBpp - only 2 and 4 are accepted";
+			return false;
+		}
+
+		auto quantizerIter = args.find("quantizer");
+		if (quantizerIter != args.end() && !parseQuantizer(std::string_view(quantizerIter->second.c_str(), quantizerIter->second.size()), outParams.quantizer))
+		{
+			outError = "invalid quantizer - only mediancut and wu are accepted";
+			return false;
+		}
+
+		if (!getIntArg(args, "refine", defaultParams.refineIterations, outParams.refineIterations) || outParams.refineIterations < 0)
+		{
+			outError = "invalid refine - use 0 to skip refining the palette";
+			return false;
+		}
+		if (outParams.maxHdmaChannels > 0 && (outParams.quantizer != Quantizer::MedianCut || outParams.refineIterations > 0))
+		{
+			outError = "quantizer and refine can't be used with hdmaChannels";
+			return false;
+		}
+
+		auto ditherIter = args.find("dither");
+		if (ditherIter != args.end() && !parseDither(std::string_view(ditherIter->second.c_str(), ditherIter->second.size()), outParams.dither))
+		{
+			outError = "invalid dither - only none, bayer4, bayer8, fs and atkinson are accepted";
+			return false;
+		}
+		if (outParams.lowBitDepthPalette && outParams.dither != Dither::None)
+		{
+			outError = "dither can't be used with tilePalettes";
+			return false;
+		}
+
+		auto outFormatIter = args.find("outFormat");
+		if (outFormatIter != args.end())
+		{
+			if (outFormatIter->second == "files")
+				outParams.outFormat = OutputFormat::Files;
+			else if (outFormatIter->second == "pack")
+				outParams.outFormat = OutputFormat::Pack;
+			else
+			{
+				outError = "invalid outFormat - only files and pack are accepted";
+				return false;
+			}
+		}
+		else if (outParams.outFormat == OutputFormat::PackBatch)
+		{
+			outParams.outFormat = OutputFormat::Pack;
+		}
+
+		auto outputsIter = args.find("outputs");
+		if (outputsIter != args.end() && !parseImageOutputs(std::string_view(outputsIter->second.c_str(), outputsIter->second.size()), outParams.outputs))
+		{
+			outError = "invalid outputs - use a comma-separated list of src, png, filtered, pltidx, clr, pic, map, hdma, stats or all";
+			return false;
+		}
+
+		return true;
+	}
+
+	// everything needed to process the jobs on a single stream; the image storage is kept around between jobs
+	// so that its allocations get reused
+	struct ServerSession
+	{
+		const ProcessImageParams& defaultParams;
+		IoQueue& ioQueue;
+		ServerStream& stream;
+		ProcessImageStorage storage;
+		ByteBuffer pixels;
+	};
+
+	bool respondWithError(ServerSession& session, const eastl::string& error)
+	{
+		return session.stream.writeLine("error " + error);
+	}
+
+	bool handleProcess(ServerSession& session, const RequestArgs& args)
+	{
+		ProcessImageParams params;
+		eastl::string error;
+		if (!getJobParams(session.defaultParams, args, params, error))
+			return respondWithError(session, error);
+
+		auto inIter = args.find("in");
+		auto outDirIter = args.find("outDir");
+		if (inIter == args.end() || outDirIter == args.end())
+			return respondWithError(session, "process requires in and outDir");
+
+		params.inFilePath = inIter->second.c_str();
+		params.outDirPath = outDirIter->second.c_str();
+		if (!std::filesystem::is_directory(params.outDirPath))
+			return respondWithError(session, "outDir is not a directory");
+
+		session.storage.srcImg = loadImage(params.inFilePath);
+		if (!isProcessableImage(session.storage.srcImg))
+			return respondWithError(session, "in could not be loaded, or is too large");
+
+		processImage(params, session.storage);
+		ImageArtifactList artifacts = encodeImageArtifacts(params, session.storage);
+		writeImageArtifacts(artifacts, session.ioQueue);
+
+		// don't report back until the outputs can actually be read
+		session.ioQueue.flush();
+
+		eastl::string response;
+		response.sprintf("ok %d", (int)artifacts.size());
+		bool succeeded = session.stream.writeLine(response);
+		for (const auto& artifact : artifacts)
+		{
+			succeeded = succeeded && session.stream.writeLine(artifact.path.generic_string().c_str());
+		}
+		return succeeded;
+	}
+
+	bool handleProcessPixels(ServerSession& session, const RequestArgs& args)
+	{
+		int width;
+		int height;
+		if (!getIntArg(args, "width", 0, width) || !getIntArg(args, "height", 0, height) ||
+			width <= 0 || height <= 0 || width > (int)MaxWidth || height > (int)MaxHeight)
+		{
+			// without valid dimensions, there's no telling how much pixel data follows - so the stream can't continue
+			respondWithError(session, "processPixels requires a width and height no larger than 256x224");
+			return false;
+		}
+
+		ByteBuffer& pixels = session.pixels;
+		pixels.resize(width * height * 3);
+		if (!session.stream.readBytes(pixels.data(), pixels.size()))
+			return false;
+
+		ProcessImageParams params;
+		eastl::string error;
+		if (!getJobParams(session.defaultParams, args, params, error))
+			return respondWithError(session, error);
+
+		// outputs are named after the image, even though they never touch the disk
+		auto nameIter = args.find("name");
+		params.inFilePath = nameIter != args.end() ? nameIter->second.c_str() : "image";
+		params.outDirPath.clear();
+
+		ImageArtifactList artifacts;
+		processPixels(pixels.data(), width, height, params, session.storage, artifacts);
+
+		eastl::string response;
+		response.sprintf("ok %d", (int)artifacts.size());
+		bool succeeded = session.stream.writeLine(response);
+		for (const auto& artifact : artifacts)
+		{
+			response.sprintf("%s %d", artifact.name.c_str(), (int)artifact.data.size());
+			succeeded = succeeded && session.stream.writeLine(response) && session.stream.write(artifact.data.data(), artifact.data.size());
+		}
+		return succeeded;
+	}
+
+	// returns true if the stream asked for the whole server to shut down
+	bool serveStream(const ProcessImageParams& defaultParams, IoQueue& ioQueue, ServerStream& stream)
+	{
+		ServerSession session = { defaultParams, ioQueue, stream };
+
+		eastl::string line;
+		eastl::string command;
+		RequestArgs args;
+		while (stream.readLine(line))
+		{
+			if (line.empty())
+				continue;
+
+			bool keepGoing;
+			if (!parseRequest(line, command, args))
+				keepGoing = respondWithError(session, "malformed request");
+			else if (command == "process")
+				keepGoing = handleProcess(session, args);
+			else if (command == "processPixels")
+				keepGoing = handleProcessPixels(session, args);
+			else if (command == "quit")
+				keepGoing = false;
+			else if (command == "shutdown")
+				return true;
+			else
+				keepGoing = respondWithError(session, "unknown command " + command);
+
+			if (!keepGoing)
+				break;
+		}
+		return false;
+	}
+
+#ifndef _WIN32
+	const unsigned int MaxConnections = 16;
+
+	struct ServerConnection
+	{
+		std::thread thread;
+		int fd = -1;
+		std::atomic<bool> finished{ false };
+	};
+
+	// the listener sleeps on this pipe as well as the socket, so finished connections, shutdown requests and signals
+	// can all wake it up. it's only ever written to with write(), which is safe to do from a signal handler
+	int s_wakeFds[2] = { -1, -1 };
+	std::atomic<bool> s_shutdownRequested{ false };
+
+	void wakeListener()
+	{
+		char wake = 0;
+		if (write(s_wakeFds[1], &wake, 1) < 0)
+		{
+			// the pipe is only full if the listener already has plenty of wakeups to get to
+		}
+	}
+
+	void onShutdownSignal(int)
+	{
+		s_shutdownRequested = true;
+		wakeListener();
+	}
+#endif
+}
+
+int runServer(const ProcessImageParams& defaultParams, const std::filesystem::path& socketPath, IoQueue& ioQueue)
+{
+	if (socketPath.empty())
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		// the stream is too big to comfortably live on the stack
+		std::unique_ptr<ServerStream> stream(new ServerStream(0, 1));
+		serveStream(defaultParams, ioQueue, *stream);
+		return 0;
+	}
+
+#ifdef _WIN32
+	std::cout << "Serving over a socket is not supported on this platform";
+	return 1;
+#else
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	std::string socketPathString = socketPath.string();
+	if (socketPathString.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path is too long: " << socketPathString;
+		return 1;
+	}
+	strcpy(address.sun_path, socketPathString.c_str());
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(address.sun_path);
+	if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenFd, MaxConnections) < 0)
+	{
+		std::cout << "Could not listen on socket: " << socketPathString;
+		if (listenFd >= 0)
+			close(listenFd);
+		return 1;
+	}
+
+	if (pipe(s_wakeFds) < 0)
+	{
+		std::cout << "Could not create the server's wake pipe";
+		close(listenFd);
+		unlink(address.sun_path);
+		return 1;
+	}
+	fcntl(s_wakeFds[0], F_SETFL, O_NONBLOCK);
+	fcntl(s_wakeFds[1], F_SETFL, O_NONBLOCK);
+
+	s_shutdownRequested = false;
+	struct sigaction shutdownAction = {};
+	shutdownAction.sa_handler = onShutdownSignal;
+	sigemptyset(&shutdownAction.sa_mask);
+	struct sigaction previousIntAction, previousTermAction, previousPipeAction;
+	sigaction(SIGINT, &shutdownAction, &previousIntAction);
+	sigaction(SIGTERM, &shutdownAction, &previousTermAction);
+
+	// a client hanging up mid-response should only end its own connection, rather than the process
+	struct sigaction ignoreAction = {};
+	ignoreAction.sa_handler = SIG_IGN;
+	sigemptyset(&ignoreAction.sa_mask);
+	sigaction(SIGPIPE, &ignoreAction, &previousPipeAction);
+
+	// every connection gets its own thread (and image storage); the heavy lifting still goes through the shared thread pool
+	std::vector<std::unique_ptr<ServerConnection>> connections;
+	auto joinFinishedConnections = [&connections]
+	{
+		auto firstFinished = std::partition(connections.begin(), connections.end(),
+			[](const std::unique_ptr<ServerConnection>& connection) { return !connection->finished; });
+		for (auto iter = firstFinished; iter != connections.end(); ++iter)
+		{
+			(*iter)->thread.join();
+			close((*iter)->fd);
+		}
+		connections.erase(firstFinished, connections.end());
+	};
+
+	while (!s_shutdownRequested)
+	{
+		// at the connection limit, new connections are left in the backlog until one of the current ones closes
+		pollfd pollFds[2] = { { s_wakeFds[0], POLLIN, 0 }, { listenFd, POLLIN, 0 } };
+		nfds_t numPollFds = connections.size() < MaxConnections ? 2 : 1;
+		if (poll(pollFds, numPollFds, -1) < 0)
+			continue;
+
+		if (pollFds[0].revents & POLLIN)
+		{
+			char wakes[64];
+			while (read(s_wakeFds[0], wakes, sizeof(wakes)) > 0)
+			{
+			}
+			joinFinishedConnections();
+		}
+
+		if (numPollFds == 2 && (pollFds[1].revents & POLLIN) && !s_shutdownRequested)
+		{
+			int connectionFd = accept(listenFd, nullptr, nullptr);
+			if (connectionFd < 0)
+				continue;
+
+			ServerConnection* connection = new ServerConnection;
+			connection->fd = connectionFd;
+			connections.emplace_back(connection);
+			connection->thread = std::thread([&defaultParams, &ioQueue, connection]
+			{
+				std::unique_ptr<ServerStream> stream(new ServerStream(connection->fd, connection->fd));
+				if (serveStream(defaultParams, ioQueue, *stream))
+					s_shutdownRequested = true;
+				connection->finished = true;
+				wakeListener();
+			});
+		}
+	}
+
+	// stop taking connections, and cut every remaining connection off after its current request, since that's the
+	// next time it reads from its socket
+	close(listenFd);
+	unlink(address.sun_path);
+	for (const auto& connection : connections)
+	{
+		shutdown(connection->fd, SHUT_RD);
+	}
+	for (const auto& connection : connections)
+	{
+		connection->thread.join();
+		close(connection->fd);
+	}
+
+	sigaction(SIGINT, &previousIntAction, nullptr);
+	sigaction(SIGTERM, &previousTermAction, nullptr);
+	sigaction(SIGPIPE, &previousPipeAction, nullptr);
+	close(s_wakeFds[0]);
+	close(s_wakeFds[1]);
+	s_wakeFds[0] = s_wakeFds[1] = -1;
+	return 0;
+#endif
+}
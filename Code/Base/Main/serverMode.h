@@ -0,0 +1,28 @@
+#pragma once
+
+#include <filesystem>
+
+class IoQueue;
+struct ProcessImageParams;
+
+// Long-lived server mode
+// Jobs are read from stdin (responses go to stdout), or from every connection to a unix domain socket if socketPath is
+// set. The thread pool, ntsc tables and per-connection image storage stay alive between jobs, so each job only pays for
+// quantizing and encoding. defaultParams provides the settings for anything a job doesn't specify.
+//
+// Every request is a single line of space-separated key=value pairs (values may be double-quoted):
+//   process in=<file> outDir=<dir> [hdmaChannels=N] [paletteSize=N] [tilePalettes=N] [tileBpp=2|4] [quantizer=mediancut|wu] [refine=N] [dither=none|bayer4|bayer8|fs|atkinson] [outFormat=files|pack] [outputs=a,b,...]
+//     processes the file on disk, and writes its outputs to outDir
+//     responds with "ok <count>", followed by a line with the path of each output written
+//   processPixels width=W height=H [name=<name>] [hdmaChannels=N] [paletteSize=N] [tilePalettes=N] [tileBpp=2|4] [quantizer=mediancut|wu] [refine=N] [dither=none|bayer4|bayer8|fs|atkinson] [outFormat=files|pack] [outputs=a,b,...]
+//     followed by W*H*3 bytes of 8-bit rgb pixels. W and H can be no larger than 256x224, and a request with
+//     invalid dimensions ends the stream, since the pixel data that follows can't be skipped
+//     responds with "ok <count>", followed by "<name> <size>" and then <size> bytes for each output
+//   quit
+//     stops reading from this stream or connection
+//   shutdown
+//     stops the server: no more connections are accepted, and every other connection is closed once its current
+//     request is done. SIGINT and SIGTERM do the same
+// Failed requests respond with "error <message>".
+// Up to 16 connections are served at once; any more wait to be accepted until one of them closes.
+int runServer(const ProcessImageParams& defaultParams, const std::filesystem::path& socketPath, IoQueue& ioQueue);
@@ -9,11 +9,10 @@
 #include <iostream>
 #include <string>
 
+#ifdef _WIN32
 #include <tchar.h>
 #include <windows.h>
-
-#include <ppl.h>
-#include <ppltasks.h>
+#endif
 
 #include <EASTL/array.h>
 #include <EASTL/fixed_vector.h>
@@ -0,0 +1,441 @@
+#include "Pch.h"
+
+#include <External/flags/include/flags.h>
+
+#include <Core/eastlAllocator.h>
+#include <Core/taskScheduler.h>
+#include <Main/imageEncode.h>
+#include <Main/imageNtscFilter.h>
+#include <Main/imageProcess.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <External/stb/stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the hot paths of the processor
+// Each case is timed over a set of deterministic synthetic images (plus any images in -corpus), and reported in
+// nanoseconds per source pixel (the median over -iterations runs) and allocations per run. Results can be written out
+// as json with -out, and compared against a previously written file with -baseline, in which case the exit code is
+// non-zero if any case got slower than -tolerance percent, or allocates more than it used to.
+
+// count every allocation made through the standard allocator; EASTL's are counted separately by Core/malloc.cpp
+static std::atomic<unsigned long long> s_stdAllocationCount{ 0 };
+
+void* operator new(size_t size)
+{
+	s_stdAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+namespace
+{
+	unsigned long long getAllocationCount()
+	{
+		return s_stdAllocationCount.load(std::memory_order_relaxed) + getEastlAllocationCount();
+	}
+
+	struct BenchImage
+	{
+		std::string name;
+		// srcImg is the image to benchmark; palettizedImg is what the encoders are benchmarked against
+		ProcessImageStorage storage;
+	};
+
+	struct BenchResult
+	{
+		std::string name;
+		std::string image;
+		double nsPerPixel;
+		double allocationsPerRun;
+	};
+
+	// keeps the results of benchmarked calls observable, so they can't be optimized away
+	volatile size_t s_benchSink = 0;
+
+	// xorshift32 - deterministic across platforms and runs, unlike rand()
+	unsigned int nextRandom(unsigned int& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	template<typename PixelFunc>
+	BenchImage createSyntheticImage(const char* name, PixelFunc pixelFunc)
+	{
+		BenchImage benchImage;
+		benchImage.name = name;
+		Image& img = benchImage.storage.srcImg;
+		img.width = MaxWidth;
+		img.height = MaxHeight;
+		img.data.resize(img.width * img.height);
+		for (unsigned int y = 0; y < img.height; ++y)
+		{
+			for (unsigned int x = 0; x < img.width; ++x)
+			{
+				img.data[y * img.width + x] = pixelFunc(x, y);
+			}
+		}
+		return benchImage;
+	}
+
+	std::vector<BenchImage> createSyntheticImages()
+	{
+		std::vector<BenchImage> images;
+
+		// smooth in every direction - lots of unique colors, but each one is close to its neighbours
+		images.push_back(createSyntheticImage("gradient", [](unsigned int x, unsigned int y)
+		{
+			Color color;
+			color.r = (unsigned char)x;
+			color.g = (unsigned char)(y * 255 / (MaxHeight - 1));
+			color.b = (unsigned char)((x + y) / 2);
+			return color;
+		}));
+
+		// worst case for the quantizers - nothing is coherent
+		unsigned int noiseState = 0x2545f491;
+		images.push_back(createSyntheticImage("noise", [&noiseState](unsigned int, unsigned int)
+		{
+			unsigned int random = nextRandom(noiseState);
+			Color color;
+			color.r = (unsigned char)random;
+			color.g = (unsigned char)(random >> 8);
+			color.b = (unsigned char)(random >> 16);
+			return color;
+		}));
+
+		// a differently-tinted gradient every few scanlines - the sort of image hdma palette swaps are for
+		images.push_back(createSyntheticImage("bands", [](unsigned int x, unsigned int y)
+		{
+			unsigned int band = y / 14;
+			Color color;
+			color.r = (unsigned char)((band * 53) + x / 4);
+			color.g = (unsigned char)((band * 97) + x / 8);
+			color.b = (unsigned char)((band * 29) + (y % 14) * 8);
+			return color;
+		}));
+
+		return images;
+	}
+
+	void loadCorpusImages(const std::filesystem::path& corpusPath, std::vector<BenchImage>& outImages)
+	{
+		for (const auto& entry : std::filesystem::directory_iterator(corpusPath))
+		{
+			if (!entry.is_regular_file())
+				continue;
+
+			int width = 0;
+			int height = 0;
+			int comp = 0;
+			unsigned char* data = stbi_load(entry.path().generic_string().c_str(), &width, &height, &comp, 3);
+			if (!data)
+				continue;
+
+			BenchImage benchImage;
+			benchImage.name = entry.path().filename().generic_string();
+			benchImage.storage.srcImg = createImageFromPixels(data, width, height);
+			stbi_image_free(data);
+
+			// names end up in json, so keep them to something that doesn't need escaping
+			std::replace_if(benchImage.name.begin(), benchImage.name.end(), [](char c) { return c == '"' || c == '\\' || (unsigned char)c < 0x20; }, '_');
+			if (isProcessableImage(benchImage.storage.srcImg))
+				outImages.push_back(std::move(benchImage));
+		}
+	}
+
+	// run func once to warm up, then iterations more times, timing each run
+	BenchResult runBenchmark(const std::string& name, const BenchImage& image, unsigned int iterations, const std::function<size_t()>& func)
+	{
+		s_benchSink = s_benchSink + func();
+
+		std::vector<double> runTimes;
+		runTimes.reserve(iterations);
+		unsigned long long allocationsBefore = getAllocationCount();
+		for (unsigned int i = 0; i < iterations; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			s_benchSink = s_benchSink + func();
+			auto end = std::chrono::steady_clock::now();
+			runTimes.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+		}
+		unsigned long long allocations = getAllocationCount() - allocationsBefore;
+
+		// the median is a lot less noisy than the mean when something else on the machine wakes up mid-run
+		std::sort(runTimes.begin(), runTimes.end());
+		const Image& srcImg = image.storage.srcImg;
+
+		BenchResult result;
+		result.name = name;
+		result.image = image.name;
+		result.nsPerPixel = runTimes[runTimes.size() / 2] / (srcImg.width * srcImg.height);
+		result.allocationsPerRun = (double)allocations / iterations;
+		return result;
+	}
+
+	void runBenchmarks(BenchImage& image, unsigned int iterations, std::vector<BenchResult>& outResults)
+	{
+		ProcessImageParams params;
+		params.maxColors = 256;
+
+		// quantizers - scratch storage is reused between runs, the same as the batch pipeline does
+		ProcessImageStorage scratchStorage;
+		scratchStorage.srcImg = image.storage.srcImg;
+		for (int hdmaChannels = 0; hdmaChannels <= (int)MaxHdmaChannels; ++hdmaChannels)
+		{
+			std::string name = "quantizeToSinglePalette";
+			if (hdmaChannels > 0)
+				name = "quantizeToSinglePaletteWithHdma-" + std::to_string(hdmaChannels);
+
+			params.maxHdmaChannels = hdmaChannels;
+			outResults.push_back(runBenchmark(name, image, iterations, [&params, &scratchStorage]
+			{
+				processImage(params, scratchStorage);
+				return scratchStorage.palettizedImg.palette.size();
+			}));
+		}
+
+		params.maxHdmaChannels = 0;
+		params.quantizer = Quantizer::Wu;
+		outResults.push_back(runBenchmark("quantizeToSinglePaletteWithWu", image, iterations, [&params, &scratchStorage]
+		{
+			processImage(params, scratchStorage);
+			return scratchStorage.palettizedImg.palette.size();
+		}));
+		params.quantizer = Quantizer::MedianCut;
+
+		params.refineIterations = 4;
+		outResults.push_back(runBenchmark("refineSinglePalette-4", image, iterations, [&params, &scratchStorage]
+		{
+			processImage(params, scratchStorage);
+			return scratchStorage.palettizedImg.palette.size();
+		}));
+		params.refineIterations = 0;
+
+		// dithering is benchmarked with hdma, since that's when the palette changes between scanlines
+		params.maxHdmaChannels = 4;
+		for (const char* ditherName : { "bayer8", "fs" })
+		{
+			parseDither(ditherName, params.dither);
+			outResults.push_back(runBenchmark(std::string("ditherToLiveColors-") + ditherName, image, iterations, [&params, &scratchStorage]
+			{
+				processImage(params, scratchStorage);
+				return scratchStorage.palettizedImg.palette.size();
+			}));
+		}
+		params.dither = Dither::None;
+
+		params.maxHdmaChannels = 0;
+		params.lowBitDepthPalette = true;
+		outResults.push_back(runBenchmark("quantizeToTilePalettes-8", image, iterations, [&params, &scratchStorage]
+		{
+			processImage(params, scratchStorage);
+			return scratchStorage.palettizedImg.palette.size();
+		}));
+		outResults.push_back(runBenchmark("encodeSnesTiles-4bpp", image, iterations, [&scratchStorage]
+		{
+			return encodeSnesTiles(scratchStorage.palettizedImg).size();
+		}));
+		params.lowBitDepthPalette = false;
+
+		// encoders are all run against the same typical output
+		params.maxHdmaChannels = 4;
+		processImage(params, image.storage);
+		const ProcessImageStorage& storage = image.storage;
+
+		outResults.push_back(runBenchmark("encodeSnesTiles", image, iterations, [&storage]
+		{
+			return encodeSnesTiles(storage.palettizedImg).size();
+		}));
+		outResults.push_back(runBenchmark("applyNtscFilter", image, iterations, [&storage]
+		{
+			return applyNtscFilter(storage.palettizedImg).data.size();
+		}));
+		outResults.push_back(runBenchmark("encodeImage", image, iterations, [&storage]
+		{
+			return encodeImage(getDepalettizedImage(storage.palettizedImg)).size();
+		}));
+		outResults.push_back(runBenchmark("encodeImageStatistics", image, iterations, [&storage]
+		{
+			return encodeImageStatistics(storage).size();
+		}));
+	}
+
+	std::string getResultKey(const BenchResult& result)
+	{
+		return result.name + "/" + result.image;
+	}
+
+	// one result per line, so a baseline can be read back in without a json parser
+	bool writeResults(const std::vector<BenchResult>& results, const std::filesystem::path& outPath)
+	{
+		std::ofstream out(outPath, std::ios::trunc);
+		if (!out)
+			return false;
+
+		out << "{\"results\":[\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			char line[512];
+			snprintf(line, 512, "{\"name\":\"%s\",\"image\":\"%s\",\"nsPerPixel\":%.4f,\"allocationsPerRun\":%.2f}%s\n",
+				results[i].name.c_str(), results[i].image.c_str(), results[i].nsPerPixel, results[i].allocationsPerRun,
+				i + 1 < results.size() ? "," : "");
+			out << line;
+		}
+		out << "]}\n";
+		return true;
+	}
+
+	bool readResults(const std::filesystem::path& inPath, std::map<std::string, BenchResult>& outResults)
+	{
+		std::ifstream in(inPath);
+		if (!in)
+			return false;
+
+		std::string line;
+		while (std::getline(in, line))
+		{
+			char name[256];
+			char image[256];
+			BenchResult result;
+			if (sscanf(line.c_str(), "{\"name\":\"%255[^\"]\",\"image\":\"%255[^\"]\",\"nsPerPixel\":%lf,\"allocationsPerRun\":%lf",
+				name, image, &result.nsPerPixel, &result.allocationsPerRun) != 4)
+				continue;
+
+			result.name = name;
+			result.image = image;
+			outResults[getResultKey(result)] = result;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const flags::args args(argc, argv);
+
+	const auto iterations = args.get<int>("iterations", 10);
+	if (iterations < 1)
+	{
+		std::cout << "Invalid number of iterations specified. At least 1 is required";
+		return 1;
+	}
+
+	// single-threaded by default, so timings aren't at the mercy of whatever else the machine is doing
+	const auto threads = args.get<int>("threads", 1);
+	if (threads < 0)
+	{
+		std::cout << "Invalid number of threads specified. Use 0 to run on every hardware thread";
+		return 1;
+	}
+
+	// compare the ispc targets against each other by forcing one at a time
+	const auto ispcTarget = args.get<std::string_view>("ispcTarget", "auto");
+	if (!setIspcTarget(ispcTarget))
+	{
+		std::cout << "Invalid ispc target specified. Only \"auto\", \"sse2\", \"sse4\", \"avx2\" and \"avx512skx\" are accepted";
+		return 1;
+	}
+
+	const auto tolerance = args.get<double>("tolerance", 10.0);
+	const auto corpus = std::filesystem::path(args.get<std::string_view>("corpus", ""));
+	const auto outPath = std::filesystem::path(args.get<std::string_view>("out", ""));
+	const auto baselinePath = std::filesystem::path(args.get<std::string_view>("baseline", ""));
+
+	std::map<std::string, BenchResult> baseline;
+	if (!baselinePath.empty() && !readResults(baselinePath, baseline))
+	{
+		std::cout << "Could not read baseline: " << baselinePath.c_str();
+		return 1;
+	}
+
+	TaskScheduler::init((unsigned int)threads);
+	initNtscFilter();
+
+	std::vector<BenchImage> images = createSyntheticImages();
+	if (!corpus.empty())
+	{
+		if (!std::filesystem::is_directory(corpus))
+		{
+			std::cout << "Corpus directory does not exist: " << corpus.c_str();
+			return 1;
+		}
+		loadCorpusImages(corpus, images);
+	}
+
+	std::vector<BenchResult> results;
+	for (auto& image : images)
+	{
+		runBenchmarks(image, (unsigned int)iterations, results);
+	}
+
+	bool regressed = false;
+	for (const auto& result : results)
+	{
+		char line[512];
+		snprintf(line, 512, "%-36s %-24s %10.3f ns/px %10.1f allocs", result.name.c_str(), result.image.c_str(), result.nsPerPixel, result.allocationsPerRun);
+		std::cout << line;
+
+		auto baselineIter = baseline.find(getResultKey(result));
+		if (baselineIter != baseline.end())
+		{
+			const BenchResult& baselineResult = baselineIter->second;
+			double timeDelta = (result.nsPerPixel / baselineResult.nsPerPixel - 1.0) * 100.0;
+			bool slower = timeDelta > tolerance;
+			bool moreAllocations = result.allocationsPerRun > baselineResult.allocationsPerRun;
+			snprintf(line, 512, " %+8.1f%%%s%s", timeDelta, slower ? " SLOWER" : "", moreAllocations ? " MORE ALLOCATIONS" : "");
+			std::cout << line;
+			regressed = regressed || slower || moreAllocations;
+		}
+		std::cout << "\n";
+	}
+
+	if (!outPath.empty() && !writeResults(results, outPath))
+	{
+		std::cout << "Could not write results to: " << outPath.c_str();
+		return 1;
+	}
+
+	return regressed ? 2 : 0;
+}